@@ -291,8 +291,7 @@ struct Ray{
         // Step 3: store conserved quantities
         L = r * r * sin(theta) * dphi;
         double f = 1.0 - SagA.r_s / r;
-        double dt_dλ = sqrt((dr*dr)/f + r*r*dtheta*dtheta + r*r*sin(theta)*sin(theta)*dphi*dphi);
-        E = f * dt_dλ;
+        E = sqrt(dr*dr + f * r*r * (dtheta*dtheta + sin(theta)*sin(theta)*dphi*dphi));
     }
     void step(double dλ, double rs) {
         if (r <= rs) return;
@@ -386,7 +385,7 @@ void geodesicRHS(const Ray& ray, double rhs[6], double rs) {
     rhs[3] = 
         - (rs / (2 * r * r)) * f * dt_dlambda * dt_dlambda
         + (rs / (2 * r * r * f)) * dr * dr
-        + r * (dtheta * dtheta + sin(theta) * sin(theta) * dphi * dphi);
+        + r * f * (dtheta * dtheta + sin(theta) * sin(theta) * dphi * dphi);
 
     rhs[4] = 
         - (2.0 / r) * dr * dtheta
@@ -5,6 +5,9 @@
 #include <glm/gtc/type_ptr.hpp>
 #include <vector>
 #include <iostream>
+#include <memory>
+#include <thread>
+#include <algorithm>
 
 const char* vertexShaderSource = R"glsl(
 #version 330 core
@@ -169,8 +172,205 @@ class Object {
 };
 std::vector<Object> objs = {};
 
-std::vector<float> CreateGridVertices(float size, int divisions, const std::vector<Object>& objs);
-std::vector<float> UpdateGridVertices(std::vector<float> vertices, const std::vector<Object>& objs, float halfSize, float originalY);
+// Runs fn(0..count-1) across the cores once there is enough work to split
+template <class F>
+void ParallelFor(size_t count, const F& fn) {
+    unsigned threads = std::thread::hardware_concurrency();
+    if (count < 2048 || threads < 2) {
+        for (size_t i = 0; i < count; ++i) fn(i);
+        return;
+    }
+    size_t chunk = (count + threads - 1) / threads;
+    std::vector<std::thread> pool;
+    for (unsigned t = 0; t < threads; ++t) {
+        size_t begin = t * chunk, end = std::min(count, begin + chunk);
+        if (begin >= end) break;
+        pool.emplace_back([begin, end, &fn]() { for (size_t i = begin; i < end; ++i) fn(i); });
+    }
+    for (auto& th : pool) th.join();
+}
+
+// Spacetime grid as a quadtree: a tile splits while the wells bend it by more
+// than `tolerance` across its width, so the grid is fine only around steep
+// wells and coarse elsewhere. Tiles live on a lattice of 2^MAX_DEPTH cells per
+// side and their corners share one well-depth cache. Each update re-splits or
+// merges only the tiles a moved object bends noticeably (its old or new
+// position), and adds just the moved objects' change in depth to the cached
+// vertices, in parallel. Nothing moved, nothing to do.
+class QuadtreeGrid {
+    public:
+        static const int MIN_DEPTH = 4;                 // 16 x 16 tiles at least
+        static const int MAX_DEPTH = 9;                 // 512 x 512 at most
+        static const int LATTICE = 1 << MAX_DEPTH;
+
+        std::vector<float> lines;                       // GL_LINES vertices, xyz
+
+        QuadtreeGrid(float size, float originalY) {
+            this->size = size;
+            this->halfSize = size / 2.0f;
+            this->originalY = originalY;
+            this->tolerance = size * 0.004f;
+            depthCache.assign((LATTICE + 1) * (LATTICE + 1), 0.0);
+            liveStamp.assign((LATTICE + 1) * (LATTICE + 1), 0);
+        }
+
+        // true when `lines` changed and needs uploading
+        bool Update(const std::vector<Object>& objs) {
+            std::vector<Well> now;
+            for (const auto& obj : objs) now.push_back({ obj.GetPos(), float((2 * G * obj.mass) / (c * c)) });
+            bool rebuild = !root || now.size() != wells.size();
+            std::vector<int> moved;
+            for (size_t i = 0; !rebuild && i < now.size(); ++i)
+                if (now[i].pos != wells[i].pos || now[i].rs != wells[i].rs) moved.push_back(int(i));
+            if (!rebuild && moved.empty()) return false;
+
+            std::vector<Well> before = wells;
+            wells = now;
+            if (rebuild) {
+                root.reset(new Tile{ 0, 0, 0 });
+                Refine(*root, true, before, moved);
+            } else {
+                Refine(*root, false, before, moved);
+            }
+
+            // every leaf corner once; corners live last update only need the moved terms
+            ++stamp;
+            std::vector<int> corners;
+            std::vector<char> fresh;
+            ForEachLeaf(*root, [&](const Tile& t) {
+                int n = LATTICE >> t.depth;
+                const int xs[4] = { t.x, t.x + n, t.x, t.x + n }, zs[4] = { t.z, t.z, t.z + n, t.z + n };
+                for (int k = 0; k < 4; ++k) {
+                    int v = zs[k] * (LATTICE + 1) + xs[k];
+                    if (liveStamp[v] == stamp) continue;
+                    fresh.push_back(rebuild || liveStamp[v] != stamp - 1);
+                    liveStamp[v] = stamp;
+                    corners.push_back(v);
+                }
+            });
+            ParallelFor(corners.size(), [&](size_t i) {
+                int v = corners[i];
+                glm::vec3 p = LatticePoint(v % (LATTICE + 1), v / (LATTICE + 1));
+                if (fresh[i]) {
+                    double depth = 0.0;
+                    for (const auto& w : wells) depth += WellDepth(w, p);
+                    depthCache[v] = depth;
+                } else {
+                    for (int j : moved) depthCache[v] += WellDepth(wells[j], p) - WellDepth(before[j], p);
+                }
+            });
+            EmitLines();
+            return true;
+        }
+
+    private:
+        struct Well {
+            glm::vec3 pos;
+            float rs;
+        };
+        struct Tile {
+            int x, z, depth;                            // lattice corner, level
+            std::unique_ptr<Tile> child[4];
+            bool Leaf() const { return !child[0]; }
+        };
+
+        float size, halfSize, originalY, tolerance;
+        std::unique_ptr<Tile> root;
+        std::vector<Well> wells;                        // as of the last update
+        std::vector<double> depthCache;                 // summed well depth per lattice vertex
+        std::vector<unsigned> liveStamp;                // update that last used each vertex
+        unsigned stamp = 1;
+
+        glm::vec3 LatticePoint(int x, int z) const {
+            float step = size / LATTICE;
+            return glm::vec3(-halfSize + x * step, originalY, -halfSize + z * step);
+        }
+        static double WellDepth(const Well& w, glm::vec3 p) {
+            double distance_m = glm::length(w.pos - p) * 1000.0;
+            return distance_m > w.rs ? 2.0 * 2.0 * std::sqrt(w.rs * (distance_m - w.rs)) : 0.0;
+        }
+        // how far the well's depth strays from linear across the tile:
+        // |depth''| at the tile's nearest point times width^2 / 8
+        float Bend(const Well& w, const Tile& t) const {
+            int n = LATTICE >> t.depth;
+            glm::vec3 lo = LatticePoint(t.x, t.z), hi = LatticePoint(t.x + n, t.z + n);
+            glm::vec3 nearest(glm::clamp(w.pos.x, lo.x, hi.x), originalY, glm::clamp(w.pos.z, lo.z, hi.z));
+            double distance_m = glm::length(w.pos - nearest) * 1000.0;
+            double width = hi.x - lo.x;
+            double curvature = 1e6 * std::sqrt(w.rs) / std::pow(std::max(distance_m - w.rs, double(w.rs)), 1.5);
+            return float(curvature * width * width / 8.0);
+        }
+        // fresh tiles (new, or the whole tree on a rebuild) are decided in full;
+        // otherwise a subtree no moved well bends noticeably keeps its shape,
+        // since its tiles are only smaller and farther away
+        void Refine(Tile& t, bool fresh, const std::vector<Well>& before, const std::vector<int>& moved) {
+            if (!fresh) {
+                bool touched = false;
+                for (int j : moved)
+                    if (Bend(before[j], t) > tolerance / 8 || Bend(wells[j], t) > tolerance / 8) touched = true;
+                if (!touched) return;
+            }
+            float bend = 0.0f;
+            for (const auto& w : wells) bend += Bend(w, t);
+            bool split = t.depth < MIN_DEPTH || (t.depth < MAX_DEPTH && bend > tolerance);
+            if (!split) {
+                for (auto& ch : t.child) ch.reset();
+                return;
+            }
+            bool created = t.Leaf();
+            int half = (LATTICE >> t.depth) / 2;
+            for (int k = 0; k < 4; ++k) {
+                if (created) t.child[k].reset(new Tile{ t.x + (k & 1) * half, t.z + (k >> 1) * half, t.depth + 1 });
+                Refine(*t.child[k], fresh || created, before, moved);
+            }
+        }
+        template <class F>
+        void ForEachLeaf(const Tile& t, const F& fn) const {
+            if (t.Leaf()) { fn(t); return; }
+            for (const auto& ch : t.child) ForEachLeaf(*ch, fn);
+        }
+        // size of the leaf around (x2, z2) in half-lattice units, 0 outside the grid
+        int LeafSizeAt(int x2, int z2) const {
+            if (x2 < 0 || z2 < 0 || x2 > 2 * LATTICE || z2 > 2 * LATTICE) return 0;
+            const Tile* t = root.get();
+            while (!t->Leaf()) {
+                int half = (LATTICE >> t->depth) / 2;
+                int k = (x2 >= 2 * (t->x + half) ? 1 : 0) + (z2 >= 2 * (t->z + half) ? 2 : 0);
+                t = t->child[k].get();
+            }
+            return LATTICE >> t->depth;
+        }
+        float Height(int x, int z) const {
+            // the four corners' depth, interpolated and taken off as before
+            float u = float(x) / LATTICE, v = float(z) / LATTICE;
+            auto at = [this](int cx, int cz) { return depthCache[cz * (LATTICE + 1) + cx]; };
+            double shift = (1 - u) * (1 - v) * at(0, 0) + u * (1 - v) * at(LATTICE, 0) +
+                           (1 - u) * v * at(0, LATTICE) + u * v * at(LATTICE, LATTICE);
+            return originalY + float(at(x, z) - shift) + halfSize / 3;
+        }
+        // each leaf edge is drawn by the finer tile on it (the lower one when
+        // equal), so a coarse edge next to finer tiles follows their vertices
+        void EmitLines() {
+            lines.clear();
+            ForEachLeaf(*root, [&](const Tile& t) {
+                int n = LATTICE >> t.depth;
+                // side: from corner, to corner, a point just across it, low side
+                struct Side { int x0, z0, x1, z1, ax, az; bool low; };
+                const Side sides[4] = {
+                    { t.x, t.z, t.x, t.z + n, 2 * t.x - 1, 2 * t.z + n, true },
+                    { t.x, t.z, t.x + n, t.z, 2 * t.x + n, 2 * t.z - 1, true },
+                    { t.x + n, t.z, t.x + n, t.z + n, 2 * (t.x + n) + 1, 2 * t.z + n, false },
+                    { t.x, t.z + n, t.x + n, t.z + n, 2 * t.x + n, 2 * (t.z + n) + 1, false },
+                };
+                for (const Side& s : sides) {
+                    int across = LeafSizeAt(s.ax, s.az);
+                    if (across != 0 && (across < n || (across == n && !s.low))) continue;
+                    glm::vec3 a = LatticePoint(s.x0, s.z0), b = LatticePoint(s.x1, s.z1);
+                    lines.insert(lines.end(), { a.x, Height(s.x0, s.z0), a.z, b.x, Height(s.x1, s.z1), b.z });
+                }
+            });
+        }
+};
 
 GLuint gridVAO, gridVBO;
 
@@ -223,10 +423,11 @@ int main() {
     int divisions = 50;
     float step = size / divisions;
     float halfSize = size / 2.0f;
-    float originalY = -halfSize * 0.3f + 3 * step; // Matches CreateGridVertices
+    float originalY = -halfSize * 0.3f + 3 * step; // plane of the old 50-division grid
 
-    std::vector<float> gridVertices = CreateGridVertices(size, divisions, objs);
-    CreateVBOVAO(gridVAO, gridVBO, gridVertices.data(), gridVertices.size());
+    QuadtreeGrid grid(size, originalY);
+    grid.Update(objs);
+    CreateVBOVAO(gridVAO, gridVBO, grid.lines.data(), grid.lines.size());
 
     while (!glfwWindowShouldClose(window) && running == true) {
         float currentFrame = glfwGetTime();
@@ -254,10 +455,11 @@ int main() {
         glUniform4f(objectColorLoc, 1.0f, 1.0f, 1.0f, 0.25f);
         glUniform1i(glGetUniformLocation(shaderProgram, "isGrid"), 1);
         glUniform1i(glGetUniformLocation(shaderProgram, "GLOW"), 0);
-        gridVertices = UpdateGridVertices(gridVertices, objs, halfSize, originalY);
-        glBindBuffer(GL_ARRAY_BUFFER, gridVBO);
-        glBufferData(GL_ARRAY_BUFFER, gridVertices.size() * sizeof(float), gridVertices.data(), GL_DYNAMIC_DRAW);
-        DrawGrid(shaderProgram, gridVAO, gridVertices.size());
+        if (grid.Update(objs)) {
+            glBindBuffer(GL_ARRAY_BUFFER, gridVBO);
+            glBufferData(GL_ARRAY_BUFFER, grid.lines.size() * sizeof(float), grid.lines.data(), GL_DYNAMIC_DRAW);
+        }
+        DrawGrid(shaderProgram, gridVAO, grid.lines.size());
         // Draw the triangles / sphere
         for(auto& obj : objs) {
             glUniform4f(objectColorLoc, obj.color.r, obj.color.g, obj.color.b, obj.color.a);
@@ -564,138 +766,3 @@ void DrawGrid(GLuint shaderProgram, GLuint gridVAO, size_t vertexCount) {
     glDrawArrays(GL_LINES, 0, vertexCount / 3);
     glBindVertexArray(0);
 }
-std::vector<float> CreateGridVertices(float size, int divisions, const std::vector<Object>& objs) {
-    
-    std::vector<float> vertices;
-    float step = size / divisions;
-    float halfSize = size / 2.0f;
-
-    // x axis
-    for (int yStep = 3; yStep <= 3; ++yStep) {
-        float y = -halfSize*0.3f + yStep * step;
-        for (int zStep = 0; zStep <= divisions; ++zStep) {
-            float z = -halfSize + zStep * step;
-            for (int xStep = 0; xStep < divisions; ++xStep) {
-                float xStart = -halfSize + xStep * step;
-                float xEnd = xStart + step;
-                vertices.push_back(xStart); vertices.push_back(y); vertices.push_back(z);
-                vertices.push_back(xEnd);   vertices.push_back(y); vertices.push_back(z);
-            }
-        }
-    }
-    // zaxis
-    for (int xStep = 0; xStep <= divisions; ++xStep) {
-        float x = -halfSize + xStep * step;
-        for (int yStep = 3; yStep <= 3; ++yStep) {
-            float y = -halfSize*0.3f + yStep * step;
-            for (int zStep = 0; zStep < divisions; ++zStep) {
-                float zStart = -halfSize + zStep * step;
-                float zEnd = zStart + step;
-                vertices.push_back(x); vertices.push_back(y); vertices.push_back(zStart);
-                vertices.push_back(x); vertices.push_back(y); vertices.push_back(zEnd);
-            }
-        }
-    }
-
-    
-
-    return vertices;
-
-}
-std::vector<float> UpdateGridVertices(std::vector<float> vertices, const std::vector<Object>& objs, float halfSize, float originalY) {
-
-    glm::vec3 cornerLL(-halfSize, originalY, -halfSize); 
-    float dy_LL = 0.0f;
-    for (const auto& obj : objs) {
-        glm::vec3 toObject = obj.GetPos() - cornerLL;
-        float distance = glm::length(toObject);
-        float distance_m = distance * 1000.0f;
-        float rs = (2 * G * obj.mass) / (c * c);
-        if (distance_m > rs) {
-            float dz = 2 * std::sqrt(rs * (distance_m - rs));
-            dy_LL += dz * 2.0f;
-        }
-    }
-
-    glm::vec3 cornerLR(halfSize, originalY, -halfSize); 
-    float dy_LR = 0.0f;
-    for (const auto& obj : objs) {
-        glm::vec3 toObject = obj.GetPos() - cornerLR;
-        float distance = glm::length(toObject);
-        float distance_m = distance * 1000.0f;
-        float rs = (2 * G * obj.mass) / (c * c);
-        if (distance_m > rs) {
-            float dz = 2 * std::sqrt(rs * (distance_m - rs));
-            dy_LR += dz * 2.0f;
-        }
-    }
-
-    glm::vec3 cornerUL(-halfSize, originalY, halfSize); 
-    float dy_UL = 0.0f;
-    for (const auto& obj : objs) {
-        glm::vec3 toObject = obj.GetPos() - cornerUL;
-        float distance = glm::length(toObject);
-        float distance_m = distance * 1000.0f;
-        float rs = (2 * G * obj.mass) / (c * c);
-        if (distance_m > rs) {
-            float dz = 2 * std::sqrt(rs * (distance_m - rs));
-            dy_UL += dz * 2.0f;
-        }
-    }
-
-    glm::vec3 cornerUR(halfSize, originalY, halfSize); 
-    float dy_UR = 0.0f;
-    for (const auto& obj : objs) {
-        glm::vec3 toObject = obj.GetPos() - cornerUR;
-        float distance = glm::length(toObject);
-        float distance_m = distance * 1000.0f;
-        float rs = (2 * G * obj.mass) / (c * c);
-        if (distance_m > rs) {
-            float dz = 2 * std::sqrt(rs * (distance_m - rs));
-            dy_UR += dz * 2.0f;
-        }
-    }
-
-    for (size_t i = 0; i < vertices.size(); i += 3) {
-        float x = vertices[i];
-        float z = vertices[i + 2];
-
-        glm::vec3 vertexPos(x, originalY, z);
-        float dy = 0.0f;
-        for (const auto& obj : objs) {
-            glm::vec3 toObject = obj.GetPos() - vertexPos;
-            float distance = glm::length(toObject);
-            float distance_m = distance * 1000.0f;
-            float rs = (2 * G * obj.mass) / (c * c);
-            if (distance_m > rs) {
-                float dz = 2 * std::sqrt(rs * (distance_m - rs));
-                dy += dz * 2.0f;
-            }
-        }
-
-        float u = (x + halfSize) / (2 * halfSize); 
-        float v = (z + halfSize) / (2 * halfSize);
-
-        float shift = (1 - u) * (1 - v) * dy_LL +  // Lower-left contribution
-                      u * (1 - v) * dy_LR +        // Lower-right
-                      (1 - u) * v * dy_UL +        // Upper-left
-                      u * v * dy_UR;               // Upper-right
-
-        vertices[i + 1] = originalY + (dy - shift) + halfSize / 3;
-    }
-
-    return vertices;
-}
-
-
-
-
-
-
-
-
-
-
-
-
-
@@ -13,9 +13,17 @@
 #include <chrono>
 #include <fstream>
 #include <sstream>
+#include <cstdlib>
+#include <string>
+#include <map>
+#include <random>
 #ifndef M_PI
 #define M_PI 3.14159265358979323846
 #endif
+#include "geodesic_cpu.h"
+#include "program_cache.h"
+#include "frame_capture.h"
+#include "profiler.h"
 using namespace glm;
 using namespace std;
 using Clock = std::chrono::high_resolution_clock;
@@ -25,8 +33,295 @@ double lastPrintTime = 0.0;
 int    framesCount   = 0;
 double c = 299792458.0;
 double G = 6.67430e-11;
-struct Ray;
 bool Gravity = false;
+bool Panorama = false; // key P: equirectangular 360 view instead of the pinhole camera
+int DiskColorMode = 0;  // key C: classic, Doppler shifted, animated (diskColorMode in geodesic.comp)
+
+// Spacetime grid line colouring (keys 1-3)
+enum class GravityLineColorMode { Fixed, Distance, Velocity };
+GravityLineColorMode gravityLineColorMode = GravityLineColorMode::Fixed;
+vec3 fixedLineColor = vec3(0.5f, 0.5f, 0.5f);
+const float GRID_EXTENT = 2.5e11f;   // side of the grid, whatever its resolution
+const int GRID_MAX = 2048;           // BLACKHOLE_GRID cap
+
+// -- Compute backend -- //
+// BLACKHOLE_BACKEND=cpu runs the geodesic.comp pass on the CPU (no GL 4.3 needed),
+// BLACKHOLE_HEADLESS=<frames> traces that many frames without opening a window,
+// BLACKHOLE_DUMP=<file.ppm> writes the first traced frame so both paths can be diffed.
+// BLACKHOLE_BACKEND=hybrid splits every frame between the compute shader and the CPU pool.
+// BLACKHOLE_SPIN=<a> makes Sagittarius A* a Kerr hole with a = J/M (-1 < a < 1) about +y.
+// BLACKHOLE_DISK_THICKNESS=<h> swaps the thin disk for a volumetric one of scale height h r_s.
+// BLACKHOLE_STARS=<file.stars> puts a BuildStarCatalog star field behind the hole.
+// BLACKHOLE_WAVEFRONT=<steps> traces on the GPU in wavefront passes of that many steps.
+// BLACKHOLE_FRAME_BUDGET=<ms> resizes the traced image every frame to keep the trace within ms.
+// BLACKHOLE_TEMPORAL=1 shows a 2x image per axis, traces a quarter of it and reprojects the rest.
+// BLACKHOLE_UPSCALE=1 upscales the traced image to the window edge-aware (upscale.comp).
+// BLACKHOLE_LENSING_CACHE=1 re-integrates rays only when the camera or masses move.
+//   When only objects move, it re-traces just the pixels whose paths they can touch.
+// BLACKHOLE_FRAMES_IN_FLIGHT=<1-4> lets the CPU record that many frames ahead of the GPU (default 2).
+// BLACKHOLE_SHADER_CACHE=<dir> keeps linked shader programs there (default shader_cache, empty = off).
+// BLACKHOLE_TUNE_GROUPS=1 times geodesic.comp workgroup sizes at startup and keeps the fastest.
+// BLACKHOLE_CLUSTER=<n> adds n small stars around the hole; past 16 objects the GPU bins them in a grid.
+// BLACKHOLE_GRID=<n> draws the spacetime grid with n x n cells (default 25), displaced in grid.vert.
+// BLACKHOLE_RECORD=<file.y4m|shot.png|file.rgb> records every shown frame (headless: every traced one);
+//   BLACKHOLE_RECORD_FPS=<n> is the rate written into a .y4m header (default 60).
+// BLACKHOLE_PROFILE=<trace.json> profiles CPU and GPU stages; F9 (and exit) writes a Chrome trace and percentiles.
+enum class ComputeBackend { GPU, CPU, Hybrid };
+const int GPU_STAR_ORDER = 8;  // star catalog levels uploaded to geodesic.comp (~1M cells)
+const GLsizeiptr WAVE_RAY_BYTES = 128; // WaveRay in geodesic.comp
+const int WAVE_POLL = 16;              // extend passes between reads of the live-ray count
+enum WavePass { WAVE_GENERATE = 1, WAVE_SETUP = 2, WAVE_EXTEND = 3 }; // `wavefront` in geodesic.comp
+const GLsizeiptr HISTORY_SAMPLE_BYTES = 32;                           // Sample in geodesic.comp
+enum TemporalPass { TEMPORAL_TRACE = 1, TEMPORAL_RESOLVE = 2 };       // `temporal` in geodesic.comp
+const GLsizeiptr GBUFFER_SAMPLE_BYTES = 32;                           // GSample in geodesic.comp
+const GLsizeiptr LENS_SAMPLE_BYTES = 64;                              // LensSample in geodesic.comp
+const int LENS_CELLS = 5;                                             // CELLS in geodesic.comp
+enum RetracePass { RETRACE_MARK = 1, RETRACE_SETUP = 2, RETRACE_TRACE = 3 }; // `retrace` in geodesic.comp
+enum class LensMap { Current, ObjectsMoved, Stale };
+
+// -- Hybrid band balancer -- //
+// The compute image is cut into 16-row bands: [0, split) go to geodesic.comp,
+// [split, n) to the CPU pool. Per-band costs are measured on whichever device
+// traced the band, the GPU/CPU speed ratio is learned from bands both have
+// traced, and the split moves to where both sides should finish together.
+struct BandBalancer {
+    int split = 0;
+    vector<double> gpuCost, cpuCost;     // seconds per band, < 0 = never traced there
+    double gpuTime = 0.0, cpuTime = 0.0; // last frame, for the stats line
+
+    int bands() const { return int(gpuCost.size()); }
+    void reset(int n) {
+        gpuCost.assign(n, -1.0);
+        cpuCost.assign(n, -1.0);
+        split = n / 2;
+    }
+    void update(const vector<double>& gpuBand, const vector<double>& cpuBandThread, double cpuWall) {
+        const int n = bands();
+        const double alpha = 0.5;
+        auto smooth = [&](double& est, double v) { est = est < 0.0 ? v : est + alpha * (v - est); };
+
+        gpuTime = 0.0;
+        for (int b = 0; b < split; ++b) {
+            smooth(gpuCost[b], gpuBand[b]);
+            gpuTime += gpuBand[b];
+        }
+        // CPU bands run concurrently, so spread the wall time by each band's share of thread time
+        double thread = 0.0;
+        for (int b = split; b < n; ++b) thread += cpuBandThread[b];
+        cpuTime = cpuWall;
+        if (thread > 0.0)
+            for (int b = split; b < n; ++b) smooth(cpuCost[b], cpuWall * cpuBandThread[b] / thread);
+        if (n < 2) return;
+
+        // CPU seconds per GPU second, preferably from bands both devices have traced
+        double sg = 0.0, sc = 0.0;
+        for (int b = 0; b < n; ++b)
+            if (gpuCost[b] >= 0.0 && cpuCost[b] >= 0.0) { sg += gpuCost[b]; sc += cpuCost[b]; }
+        if (sg <= 0.0 || sc <= 0.0) {
+            sg = sc = 0.0;
+            for (int b = 0; b < split; ++b) sg += gpuCost[b] / split;
+            for (int b = split; b < n; ++b) sc += cpuCost[b] / (n - split);
+        }
+        double ratio = (sg > 0.0 && sc > 0.0) ? sc / sg : 1.0;
+
+        // predict every band on both devices from its latest measurement
+        auto g = [&](int b) { return b < split ? gpuCost[b] : cpuCost[b] / ratio; };
+        auto c = [&](int b) { return b < split ? gpuCost[b] * ratio : cpuCost[b]; };
+
+        // keep at least one band on each side so both keep getting measured
+        double gpuSum = 0.0, cpuSum = 0.0;
+        for (int b = 1; b < n; ++b) cpuSum += c(b);
+        gpuSum = g(0);
+        int best = 1;
+        double bestCost = max(gpuSum, cpuSum);
+        for (int k = 2; k < n; ++k) {
+            gpuSum += g(k - 1);
+            cpuSum -= c(k - 1);
+            double cost = max(gpuSum, cpuSum);
+            if (cost < bestCost) { bestCost = cost; best = k; }
+        }
+        split = best;
+    }
+};
+
+// -- Dynamic resolution -- //
+// The trace resolution is k * (16 x 12), so it keeps the window's 4:3 shape and
+// whole 16-wide workgroups. Trace times arrive a few frames late (timer queries
+// are read without waiting), so after a change the controller collects
+// RES_SETTLE fresh samples before it moves again. It drops at once when a
+// frame is over budget but climbs one step at a time, and only when the next
+// step is predicted to stay under RES_TARGET of the budget; the gap between
+// the two keeps it from flipping between neighbouring sizes.
+const float RES_TARGET = 0.9f;
+const int   RES_SETTLE = 4;
+
+struct ResolutionController {
+    double budget = 0.0;     // seconds per trace, 0 = fixed resolution
+    int k = 12, kMin = 4, kMax = 12;
+    double mean = 0.0;       // smoothed trace time at the current k
+    int samples = 0;
+    int skip = 0;            // samples still in flight from before the last change
+
+    int width() const { return 16 * k; }
+    int height() const { return 12 * k; }
+    void update(double sec, int lag) {
+        if (budget <= 0.0) return;
+        if (skip > 0) { --skip; return; }
+        mean = samples++ == 0 ? sec : mean + 0.25 * (sec - mean);
+        // pixels, and so trace time, go as k^2
+        int want = int(std::floor(k * std::sqrt(RES_TARGET * budget / mean)));
+        int next = k;
+        if (sec > budget) next = min(want, k - 1);
+        else if (samples >= RES_SETTLE && want > k) next = k + 1;
+        next = glm::clamp(next, kMin, kMax);
+        if (next == k) return;
+        k = next;
+        samples = 0;
+        skip = lag;
+    }
+};
+
+// -- Frame pipeline -- //
+// The CPU records frame N+1 (physics, grid, uploads) while the GPU still runs
+// frame N. Each frame ends with a fence; once the CPU is `depth` frames ahead
+// it waits on the oldest one, so depth 1 runs the two strictly in turn. What
+// a frame's GPU work reads from CPU-written memory lives in the upload rings
+// below, and a copy there is only rewritten after the fence of the last frame
+// that read it. Per frame the stats line reports CPU recording time, time
+// blocked on fences, and the GPU span between timestamps at the frame's first
+// and last command; with the two overlapping the frame takes about the larger
+// of CPU and GPU instead of their sum.
+const int MAX_FRAMES_IN_FLIGHT = 4;
+const int FRAME_RING = MAX_FRAMES_IN_FLIGHT + 1;   // frame s uses slot s % FRAME_RING
+
+struct FramePipeline {
+    int depth = 2;                            // BLACKHOLE_FRAMES_IN_FLIGHT
+    uint64_t frame = 0;                       // serial of the frame being recorded
+    GLsync fence[FRAME_RING] = {};
+    uint64_t fenceFrame[FRAME_RING] = {};
+    GLuint stamps[FRAME_RING][2] = {};        // GL_TIMESTAMP at the frame's begin / end
+    uint64_t harvested = 0;                   // frames whose stamps have been read
+    static constexpr uint64_t NEVER = ~uint64_t(0);
+    Clock::time_point frameStart;
+    double frameWait = 0.0;
+    // totals since the stats line last printed
+    double cpuSec = 0.0, waitSec = 0.0, gpuSec = 0.0;
+    int cpuFrames = 0, gpuFrames = 0;
+
+    void beginFrame() {
+        if (!stamps[0][0]) glGenQueries(2 * FRAME_RING, &stamps[0][0]);
+        frameStart = Clock::now();
+        frameWait = 0.0;
+        glQueryCounter(stamps[frame % FRAME_RING][0], GL_TIMESTAMP);
+    }
+    // blocks until the GPU has finished frame s
+    void waitFor(uint64_t s) {
+        if (s == NEVER) return;
+        ProfileZone zone("fence wait");
+        auto t0 = Clock::now();
+        if (s >= frame) {
+            glFinish();
+        } else {
+            int i = int(s % FRAME_RING);
+            if (!fence[i] || fenceFrame[i] != s) return;   // long done
+            while (glClientWaitSync(fence[i], GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000) == GL_TIMEOUT_EXPIRED) {}
+            glDeleteSync(fence[i]);
+            fence[i] = nullptr;
+        }
+        frameWait += chrono::duration<double>(Clock::now() - t0).count();
+    }
+    // fences the frame just recorded, then waits until at most `depth` are in flight
+    void endFrame() {
+        int i = int(frame % FRAME_RING);
+        glQueryCounter(stamps[i][1], GL_TIMESTAMP);
+        if (fence[i]) glDeleteSync(fence[i]);   // finished long ago (depth < FRAME_RING)
+        fence[i] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        fenceFrame[i] = frame++;
+        if (frame >= uint64_t(depth)) {
+            uint64_t done = frame - depth;      // oldest frame allowed to still run: done + 1
+            waitFor(done);
+            for (; harvested <= done; ++harvested) {
+                GLuint64 t0 = 0, t1 = 0;
+                glGetQueryObjectui64v(stamps[harvested % FRAME_RING][0], GL_QUERY_RESULT, &t0);
+                glGetQueryObjectui64v(stamps[harvested % FRAME_RING][1], GL_QUERY_RESULT, &t1);
+                gpuSec += (t1 - t0) * 1e-9;
+                ++gpuFrames;
+            }
+        }
+        double sec = chrono::duration<double>(Clock::now() - frameStart).count();
+        cpuSec += sec - frameWait;
+        waitSec += frameWait;
+        ++cpuFrames;
+    }
+    void printStats() {
+        if (cpuFrames == 0) return;
+        cout << "[PIPE] " << depth << " frame(s) in flight: CPU " << cpuSec / cpuFrames * 1000.0
+             << " ms, waited " << waitSec / cpuFrames * 1000.0 << " ms, GPU "
+             << (gpuFrames ? gpuSec / gpuFrames * 1000.0 : 0.0) << " ms per frame" << endl;
+        cpuSec = waitSec = gpuSec = 0.0;
+        cpuFrames = gpuFrames = 0;
+    }
+};
+
+// -- Upload rings -- //
+// Per-frame uploads go through persistently mapped buffers (glBufferStorage)
+// instead of glBufferSubData/glBufferData, which stall or reallocate when the
+// GPU still reads the old contents. Each stream holds FRAME_RING copies; a
+// changed upload goes to the next copy once the last frame that read it has
+// signalled its fence, an unchanged one is skipped and the current copy stays
+// bound. Without ARB_buffer_storage a stream is one plain buffer.
+struct UploadStream {
+    GLenum target = 0;
+    GLuint buffer = 0;
+    char* mapped = nullptr;        // null: no buffer storage, plain glBufferSubData
+    GLsizeiptr slotBytes = 0;      // one copy, rounded up to the binding alignment
+    int slot = 0;
+    uint64_t slotFrame[FRAME_RING];     // last frame that read each copy
+    vector<char> last;             // contents of the current copy
+    uint64_t writes = 0, skips = 0;
+
+    void init(GLenum t, GLsizeiptr bytes) {
+        target = t;
+        for (uint64_t& f : slotFrame) f = FramePipeline::NEVER;
+        GLint align = 16;
+        if (t == GL_UNIFORM_BUFFER) glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &align);
+        if (t == GL_SHADER_STORAGE_BUFFER) glGetIntegerv(GL_SHADER_STORAGE_BUFFER_OFFSET_ALIGNMENT, &align);
+        slotBytes = (bytes + align - 1) / align * align;
+        glGenBuffers(1, &buffer);
+        glBindBuffer(t, buffer);
+        if (GLEW_ARB_buffer_storage) {
+            const GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+            glBufferStorage(t, slotBytes * FRAME_RING, nullptr, flags);
+            mapped = static_cast<char*>(glMapBufferRange(t, 0, slotBytes * FRAME_RING, flags));
+        } else {
+            glBufferData(t, slotBytes, nullptr, GL_DYNAMIC_DRAW);
+        }
+    }
+    // true when the contents changed and the stream moved to a new copy
+    bool update(const void* data, GLsizeiptr size, FramePipeline& fences) {
+        if (GLsizeiptr(last.size()) == size && memcmp(last.data(), data, size) == 0) {
+            slotFrame[slot] = fences.frame;
+            ++skips;
+            return false;
+        }
+        last.assign(static_cast<const char*>(data), static_cast<const char*>(data) + size);
+        ++writes;
+        if (!mapped) {
+            glBindBuffer(target, buffer);
+            glBufferSubData(target, 0, size, data);
+            return true;
+        }
+        slot = (slot + 1) % FRAME_RING;
+        fences.waitFor(slotFrame[slot]);
+        slotFrame[slot] = fences.frame;
+        memcpy(mapped + offset(), data, size);
+        return true;
+    }
+    GLintptr offset() const { return mapped ? slot * slotBytes : 0; }
+    void bindBase(GLuint binding) const {
+        glBindBufferRange(target, binding, buffer, offset(), GLsizeiptr(last.size()));
+    }
+};
 
 struct Camera {
     // Center the camera orbit on the black hole at (0, 0, 0)
@@ -115,6 +410,15 @@ struct Camera {
             Gravity = !Gravity;
             cout << "[INFO] Gravity turned " << (Gravity ? "ON" : "OFF") << endl;
         }
+        if (action == GLFW_PRESS && key == GLFW_KEY_P) {
+            Panorama = !Panorama;
+            cout << "[INFO] " << (Panorama ? "Equirectangular 360" : "Pinhole") << " view" << endl;
+        }
+        if (action == GLFW_PRESS && key == GLFW_KEY_C) {
+            static const char* names[] = { "classic", "Doppler shifted", "animated" };
+            DiskColorMode = (DiskColorMode + 1) % 3;
+            cout << "[INFO] Disk colours: " << names[DiskColorMode] << " (gpu backend)" << endl;
+        }
     }
 };
 Camera camera;
@@ -147,8 +451,24 @@ vector<ObjectData> objects = {
     { vec4(0.0f, 0.0f, 0.0f, SagA.r_s) , vec4(0,0,0,1), static_cast<float>(SagA.mass)  },
     //{ vec4(6e10f, 0.0f, 0.0f, 5e10f), vec4(0,1,0,1) }
 };
+// BLACKHOLE_CLUSTER: n solar-mass stars scattered through a shell around the
+// hole, the same ones every run
+void addCluster(int n) {
+    std::mt19937 rng(1);
+    std::uniform_real_distribution<float> u(0.0f, 1.0f);
+    for (int i = 0; i < n; ++i) {
+        vec3 dir;
+        do dir = vec3(u(rng), u(rng), u(rng)) * 2.0f - vec3(1.0f);
+        while (dot(dir, dir) > 1.0f || dot(dir, dir) < 1e-4f);
+        float r = 1.5e11f + 6.5e11f * u(rng);
+        float size = 3e9f + 5e9f * u(rng);
+        vec3 color = mix(vec3(1.0f, 0.6f, 0.3f), vec3(0.7f, 0.8f, 1.0f), u(rng)); // cool to hot
+        objects.push_back({ vec4(normalize(dir) * r, size), vec4(color, 1.0f), 1.98892e30f });
+    }
+}
 
 struct Engine {
+    Clock::time_point startTime = Clock::now(); // engine is a global: about process start
     GLuint gridShaderProgram;
     // -- Quad & Texture render -- //
     GLFWwindow* window;
@@ -156,29 +476,119 @@ struct Engine {
     GLuint texture;
     GLuint shaderProgram;
     GLuint computeProgram = 0;
+    // -- Program builds (program_cache.h) -- //
+    string shaderCacheDir = "shader_cache"; // BLACKHOLE_SHADER_CACHE, empty = off
+    ProgramCache programCache;
+    ProgramBuild quadBuild, gridBuild, upscaleBuild;
+    string computeSource;                   // geodesic.comp as read at startup
+    map<string, ProgramBuild> computeVariants; // by #define block, see computeVariant
+    bool firstFrameShown = false, firstTracedShown = false;
+    // -- Body grid (body_grid.comp) -- //
+    bool bodyGrid = false;                 // more objects than the Objects UBO holds
+    ProgramBuild bodyGridBuild;
+    UploadStream bodiesSSBO;               // Body per object, binding 13
+    GLuint bodyGridSSBO = 0;               // cellEnd + cellBody, binding 14
+    GLsizeiptr bodyGridCapacity = 0;
+    vec3 bodyGridOrigin = vec3(0.0f), bodyCellSize = vec3(1.0f);
+    int bodyGridDims[3] = { 1, 1, 1 };
+    float bodiesFar = 0.0f;
+    // -- Workgroup size -- //
+    ivec2 computeGroup = ivec2(16, 16);    // geodesic.comp GROUP_X x GROUP_Y
+    bool tuneGroups = false;               // BLACKHOLE_TUNE_GROUPS
     // -- UBOs -- //
-    GLuint cameraUBO = 0;
-    GLuint diskUBO = 0;
-    GLuint objectsUBO = 0;
+    FramePipeline pipeline;          // frames in flight; owns the fences the upload rings wait on
+    UploadStream cameraUBO;
+    UploadStream diskUBO;
+    UploadStream objectsUBO;
     // -- grid mess vars -- //
     GLuint gridVAO = 0;
-    GLuint gridVBO = 0;
     GLuint gridEBO = 0;
     int gridIndexCount = 0;
+    int gridSize = 25;                     // cells per side, BLACKHOLE_GRID
 
     int WIDTH = 800;  // Window width
     int HEIGHT = 600; // Window height
     int COMPUTE_WIDTH  = 200;   // Compute resolution width
     int COMPUTE_HEIGHT = 150;  // Compute resolution height
+    // the compute texture is allocated once at this size; frames use its lower-left corner
+    int MAX_COMPUTE_WIDTH  = 800;
+    int MAX_COMPUTE_HEIGHT = 600;
+    int imageWidth = 200, imageHeight = 150; // texels of it shown this frame
     float width = 100000000000.0f; // Width of the viewport in meters
     float height = 75000000000.0f; // Height of the viewport in meters
+    // -- CPU backend -- //
+    ComputeBackend backend = ComputeBackend::GPU;
+    int headlessFrames = 0;        // > 0: no window, trace this many frames and exit
+    string dumpPath;               // first traced frame is written here when set
+    string recordPath;             // BLACKHOLE_RECORD
+    int recordFps = 60;
+    FrameCapture capture;
+    float spin = 0.0f;             // Kerr a = J/M, 0 = Schwarzschild
+    float diskThickness = 0.0f;    // volumetric disk scale height in r_s, 0 = thin disk
+    StarCatalog stars;             // memory-mapped, empty = black background
+    GLuint starsSSBO = 0;          // its top GPU_STAR_ORDER levels for geodesic.comp
+    int gpuStarOrder = -1;
+    // -- Wavefront -- //
+    int waveSteps = 0;             // > 0: steps per extend pass, 0 = one invocation per pixel
+    GLuint waveQueues[2] = { 0, 0 };
+    GLuint waveCounters = 0;       // live counts + indirect dispatch args (WaveCounters)
+    int waveCapacity = 0;          // rays each queue holds
+    bool dumped = false;
+    ThreadPool* cpuPool = nullptr;
+    CpuFramebuffer cpuFramebuffer;
+    // -- Hybrid split -- //
+    BandBalancer balancer;
+    vector<GLuint> bandQueries;    // GL_TIME_ELAPSED per GPU band
+    // -- Dynamic resolution -- //
+    ResolutionController resolution;
+    GLuint frameQueries[FRAME_RING] = {}; // GL_TIME_ELAPSED per GPU frame, read pipeline.depth frames late
+    int frameQuery = 0;
+    // -- Temporal reprojection -- //
+    bool temporal = false;
+    GLuint historySSBO[2] = { 0, 0 }; // per-pixel Samples: [temporalFrame & 1] is written this frame
+    int historyCapacity = 0;
+    int temporalFrame = 0;
+    mat3 prevBasis = mat3(1.0f);      // last frame's camera right, up, forward
+    int prevProjection = -1, prevImageW = 0, prevImageH = 0;
+    vector<vec4> prevObjects;
+    // -- Edge-aware upscale -- //
+    bool upscale = false;
+    GLuint upscaleProgram = 0;
+    GLuint displayTexture = 0;        // WIDTH x HEIGHT, what the quad shows when upscaling
+    GLuint gbufferSSBO = 0;
+    int gbufferCapacity = 0;
+    // -- Lensing map -- //
+    bool lensingCache = false;
+    GLuint lensSSBO = 0;
+    int lensCapacity = 0;
+    bool lensValid = false;
+    CameraUBO lensCamera = {};        // what the map was traced for
+    int lensProjection = -1, lensW = 0, lensH = 0;
+    vector<vec4> lensObjects;         // posRadius per object
+    vector<float> lensMasses;
+    vec3 cellOrigin = vec3(0.0f), cellSize = vec3(1.0f); // pathCells grid, fitted at every full trace
+    GLuint dirtySSBO = 0;             // DirtyPixels: count, indirect args, pixel list
+    int dirtyCapacity = 0;
+    bool frameTraced[FRAME_RING] = {};    // per frameQueries slot
     
     Engine() {
+        readBackendConfig();
+        if (backend != ComputeBackend::GPU) {
+            cpuPool = new ThreadPool();
+            cout << "[INFO] CPU compute backend, " << cpuPool->size() << " threads, "
+                 << cpu::LANES << " lanes\n";
+        }
+        if (headlessFrames > 0) {
+            window = nullptr;
+            if (!recordPath.empty()) startRecording();
+            return;
+        }
         if (!glfwInit()) {
             cerr << "GLFW init failed\n";
             exit(EXIT_FAILURE);
         }
-        glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 4);
+        // the CPU backend only needs the quad and grid shaders
+        glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, backend == ComputeBackend::CPU ? 3 : 4);
         glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
         glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
         window = glfwCreateWindow(WIDTH, HEIGHT, "Black Hole", nullptr, nullptr);
@@ -198,93 +608,130 @@ struct Engine {
             exit(EXIT_FAILURE);
         }
         cout << "OpenGL " << glGetString(GL_VERSION) << "\n";
-        this->shaderProgram = CreateShaderProgram();
-        gridShaderProgram = CreateShaderProgram("grid.vert", "grid.frag");
-
-        computeProgram = CreateComputeProgram("geodesic.comp");
-        glGenBuffers(1, &cameraUBO);
-        glBindBuffer(GL_UNIFORM_BUFFER, cameraUBO);
-        glBufferData(GL_UNIFORM_BUFFER, 128, nullptr, GL_DYNAMIC_DRAW); // alloc ~128 bytes
-        glBindBufferBase(GL_UNIFORM_BUFFER, 1, cameraUBO); // binding = 1 matches shader
-
-        glGenBuffers(1, &diskUBO);
-        glBindBuffer(GL_UNIFORM_BUFFER, diskUBO);
-        glBufferData(GL_UNIFORM_BUFFER, sizeof(float) * 4, nullptr, GL_DYNAMIC_DRAW); // 3 values + 1 padding
-        glBindBufferBase(GL_UNIFORM_BUFFER, 2, diskUBO); // binding = 2 matches compute shader
-
-        glGenBuffers(1, &objectsUBO);
-        glBindBuffer(GL_UNIFORM_BUFFER, objectsUBO);
-        // allocate space for 16 objects: 
-        // sizeof(int) + padding + 16×(vec4 posRadius + vec4 color)
-        GLsizeiptr objUBOSize = sizeof(int) + 3 * sizeof(float)
-            + 16 * (sizeof(vec4) + sizeof(vec4))
-            + 16 * sizeof(float); // 16 floats for mass
-        glBufferData(GL_UNIFORM_BUFFER, objUBOSize, nullptr, GL_DYNAMIC_DRAW);
-        glBindBufferBase(GL_UNIFORM_BUFFER, 3, objectsUBO);  // binding = 3 matches shader
+        startPrograms();
+        if (profiler().enabled) gpuProfiler().init();
+        if (!recordPath.empty()) startRecording();
 
         auto result = QuadVAO();
         this->quadVAO = result[0];
         this->texture = result[1];
+        if (backend == ComputeBackend::CPU) return;
+
+        if (upscale) {
+            glGenTextures(1, &displayTexture);
+            glBindTexture(GL_TEXTURE_2D, displayTexture);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+            glTexStorage2D(GL_TEXTURE_2D, 1, GL_RGBA8, WIDTH, HEIGHT);
+        }
+        // bound per upload, see uploadCameraUBO & co.
+        cameraUBO.init(GL_UNIFORM_BUFFER, sizeof(CameraUBO));
+        diskUBO.init(GL_UNIFORM_BUFFER, sizeof(DiskUBO)); // 3 values + 1 padding
+        // 16 objects, std140 (see ObjectsUBO in geodesic_cpu.h)
+        objectsUBO.init(GL_UNIFORM_BUFFER, sizeof(ObjectsUBO));
+
+        // the coarse star levels are small and read by every escaped ray; the
+        // per-star detail below them is only used by the CPU paths
+        if (stars.isOpen()) {
+            gpuStarOrder = std::min(stars.order, GPU_STAR_ORDER);
+            glGenBuffers(1, &starsSSBO);
+            glBindBuffer(GL_SHADER_STORAGE_BUFFER, starsSSBO);
+            glBufferData(GL_SHADER_STORAGE_BUFFER, healpixLevelStart(gpuStarOrder + 1) * 3 * sizeof(float),
+                         stars.cells, GL_STATIC_DRAW);
+            glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 4, starsSSBO); // binding = 4 matches shader
+        }
+        if (tuneGroups) tuneWorkgroup();
     }
-    void generateGrid(const vector<ObjectData>& objects) {
-        const int gridSize = 25;
-        const float spacing = 1e10f;
-
-        vector<vec3> vertices;
-        vector<vec3> colors; // Add color per vertex
-        vector<GLuint> indices;
-
-        for (int z = 0; z <= gridSize; ++z) {
-            for (int x = 0; x <= gridSize; ++x) {
-                float worldX = (x - gridSize / 2) * spacing;
-                float worldZ = (z - gridSize / 2) * spacing;
-                float y = 0.0f;
-
-                // Warp grid using Schwarzschild geometry
-                for (const auto& obj : objects) {
-                    vec3 objPos = vec3(obj.posRadius);
-                    double mass = obj.mass;
-                    double radius = obj.posRadius.w;
-                    double r_s = 2.0 * G * mass / (c * c);
-                    double dx = worldX - objPos.x;
-                    double dz = worldZ - objPos.z;
-                    double dist = sqrt(dx * dx + dz * dz);
-                    if (dist > r_s) {
-                        double deltaY = 2.0 * sqrt(r_s * (dist - r_s));
-                        y += static_cast<float>(deltaY) - 3e10f;
-                    } else {
-                        y += 2.0f * static_cast<float>(sqrt(r_s * r_s)) - 3e10f;
-                    }
-                }
-
-                vertices.emplace_back(worldX, y, worldZ);
-
-                // --- Color calculation for gravity lines ---
-                vec3 color = fixedLineColor;
-                if (gravityLineColorMode == GravityLineColorMode::Distance) {
-                    // Color by distance to black hole (blue = far, red = close)
-                    float dist = length(vec3(worldX, y, worldZ) - SagA.position);
-                    float t = glm::clamp((dist - float(SagA.r_s)) / 1e12f, 0.0f, 1.0f);
-                    color = mix(vec3(1,0,0), vec3(0,0,1), t);
-                } else if (gravityLineColorMode == GravityLineColorMode::Velocity) {
-                    // Color by velocity magnitude of the closest object
-                    float minDist = 1e20f;
-                    float vmag = 0.0f;
-                    for (const auto& obj : objects) {
-                        float d = length(vec3(worldX, y, worldZ) - vec3(obj.posRadius));
-                        if (d < minDist) {
-                            minDist = d;
-                            vmag = length(obj.velocity);
-                        }
-                    }
-                    float t = glm::clamp(vmag / 1e7f, 0.0f, 1.0f);
-                    color = mix(vec3(0,1,0), vec3(1,1,0), t); // green to yellow
-                }
-                colors.push_back(color);
+    void readBackendConfig() {
+        if (const char* b = getenv("BLACKHOLE_BACKEND")) {
+            string name = b;
+            if (name == "cpu") backend = ComputeBackend::CPU;
+            else if (name == "hybrid") backend = ComputeBackend::Hybrid;
+            else if (name != "gpu") cerr << "[WARN] Unknown BLACKHOLE_BACKEND '" << name << "', using gpu\n";
+        }
+        if (const char* h = getenv("BLACKHOLE_HEADLESS")) {
+            headlessFrames = max(atoi(h), 1);
+            if (backend != ComputeBackend::CPU) {
+                cout << "[INFO] Headless mode has no GL context, switching to the CPU backend\n";
+                backend = ComputeBackend::CPU;
             }
         }
-
-        // 🧩 Add indices for GL_LINE rendering
+        if (const char* d = getenv("BLACKHOLE_DUMP")) dumpPath = d;
+        if (const char* p = getenv("BLACKHOLE_PROFILE")) {
+            profiler().enabled = true;
+            profiler().path = *p ? p : "profile.json";
+            profiler().threadRing("main");
+        }
+        if (const char* r = getenv("BLACKHOLE_RECORD")) recordPath = r;
+        if (const char* f = getenv("BLACKHOLE_RECORD_FPS")) recordFps = max(atoi(f), 1);
+        if (const char* a = getenv("BLACKHOLE_SPIN")) {
+            spin = glm::clamp(float(atof(a)), -0.999f, 0.999f);
+            cout << "[INFO] Kerr black hole, a = " << spin << "\n";
+        }
+        if (const char* path = getenv("BLACKHOLE_STARS")) {
+            string error;
+            if (stars.open(path, &error))
+                cout << "[INFO] Star catalog " << path << ": " << stars.numStars << " stars, HEALPix order "
+                     << stars.order << "\n";
+            else
+                cerr << "[WARN] " << error << ", background stays black\n";
+        }
+        if (const char* n = getenv("BLACKHOLE_CLUSTER")) {
+            addCluster(max(atoi(n), 0));
+            cout << "[INFO] Star cluster, " << objects.size() << " objects\n";
+        }
+        if (const char* t = getenv("BLACKHOLE_DISK_THICKNESS")) {
+            diskThickness = max(float(atof(t)), 0.0f);
+            cout << "[INFO] Volumetric accretion disk, scale height " << diskThickness << " r_s\n";
+        }
+        if (const char* w = getenv("BLACKHOLE_WAVEFRONT")) {
+            waveSteps = max(atoi(w), 0);
+            if (waveSteps > 0)
+                cout << "[INFO] Wavefront ray scheduling, " << waveSteps << " steps per pass\n";
+        }
+        if (const char* t = getenv("BLACKHOLE_TEMPORAL")) {
+            temporal = atoi(t) != 0;
+            if (temporal && backend != ComputeBackend::GPU) {
+                cerr << "[WARN] BLACKHOLE_TEMPORAL needs the gpu backend, ignoring it\n";
+                temporal = false;
+            }
+            if (temporal) cout << "[INFO] Temporal reprojection, a quarter of the pixels traced per frame\n";
+        }
+        if (const char* u = getenv("BLACKHOLE_UPSCALE")) {
+            upscale = atoi(u) != 0;
+            if (upscale && backend != ComputeBackend::GPU) {
+                cerr << "[WARN] BLACKHOLE_UPSCALE needs the gpu backend, ignoring it\n";
+                upscale = false;
+            }
+            if (upscale) cout << "[INFO] Edge-aware upscale to " << WIDTH << "x" << HEIGHT << "\n";
+        }
+        if (const char* l = getenv("BLACKHOLE_LENSING_CACHE")) {
+            lensingCache = atoi(l) != 0;
+            if (lensingCache && (backend != ComputeBackend::GPU || temporal)) {
+                cerr << "[WARN] BLACKHOLE_LENSING_CACHE needs the gpu backend without BLACKHOLE_TEMPORAL, ignoring it\n";
+                lensingCache = false;
+            }
+            if (lensingCache) cout << "[INFO] Lensing map cache, rays re-traced only when the view or masses change\n";
+        }
+        if (const char* b = getenv("BLACKHOLE_FRAME_BUDGET")) {
+            resolution.budget = max(atof(b), 0.0) * 1e-3;
+            resolution.kMax = MAX_COMPUTE_WIDTH / (temporal ? 32 : 16);
+            if (resolution.budget > 0.0)
+                cout << "[INFO] Dynamic resolution, " << resolution.budget * 1000.0 << " ms trace budget\n";
+        }
+        if (const char* d = getenv("BLACKHOLE_SHADER_CACHE")) shaderCacheDir = d;
+        if (const char* t = getenv("BLACKHOLE_TUNE_GROUPS")) tuneGroups = atoi(t) != 0 && backend != ComputeBackend::CPU;
+        if (const char* g = getenv("BLACKHOLE_GRID")) gridSize = glm::clamp(atoi(g), 2, GRID_MAX);
+        if (const char* f = getenv("BLACKHOLE_FRAMES_IN_FLIGHT")) {
+            pipeline.depth = glm::clamp(atoi(f), 1, MAX_FRAMES_IN_FLIGHT);
+            cout << "[INFO] " << pipeline.depth << " frame(s) in flight\n";
+        }
+    }
+    // The line index list of the (gridSize+1)^2 lattice, written once; grid.vert
+    // places the vertices from gl_VertexID, so there are no vertex buffers.
+    void generateGrid() {
+        vector<GLuint> indices;
+        indices.reserve(size_t(4) * gridSize * gridSize);
         for (int z = 0; z < gridSize; ++z) {
             for (int x = 0; x < gridSize; ++x) {
                 int i = z * (gridSize + 1) + x;
@@ -295,37 +742,40 @@ struct Engine {
                 indices.push_back(i + gridSize + 1);
             }
         }
-
-        // 🔌 Upload to GPU (add color buffer)
-        if (gridVAO == 0) glGenVertexArrays(1, &gridVAO);
-        if (gridVBO == 0) glGenBuffers(1, &gridVBO);
-        if (gridEBO == 0) glGenBuffers(1, &gridEBO);
-        static GLuint colorVBO = 0;
-        if (colorVBO == 0) glGenBuffers(1, &colorVBO);
-
+        glGenVertexArrays(1, &gridVAO);
         glBindVertexArray(gridVAO);
-
-        glBindBuffer(GL_ARRAY_BUFFER, gridVBO);
-        glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(vec3), vertices.data(), GL_DYNAMIC_DRAW);
-        glEnableVertexAttribArray(0); // location = 0
-        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(vec3), (void*)0);
-
-        glBindBuffer(GL_ARRAY_BUFFER, colorVBO);
-        glBufferData(GL_ARRAY_BUFFER, colors.size() * sizeof(vec3), colors.data(), GL_DYNAMIC_DRAW);
-        glEnableVertexAttribArray(1); // location = 1
-        glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(vec3), (void*)0);
-
+        glGenBuffers(1, &gridEBO);
         glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, gridEBO);
         glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(GLuint), indices.data(), GL_STATIC_DRAW);
-
         gridIndexCount = indices.size();
-
         glBindVertexArray(0);
     }
-    void drawGrid(const mat4& viewProj) {
+    // Only uniforms change per frame: each warping object's position, r_s and
+    // speed, and the colour mode. Cluster bodies (BLACKHOLE_CLUSTER) leave the
+    // mesh alone, the scene's first MAX_OBJECTS objects warp it.
+    void drawGrid(const mat4& viewProj, const vector<ObjectData>& objects) {
+        if (gridVAO == 0) generateGrid();
+        const int numWarp = int(std::min(objects.size(), size_t(MAX_OBJECTS)));
+        vec4 warpPosRs[MAX_OBJECTS];
+        float warpSpeed[MAX_OBJECTS];
+        for (int i = 0; i < numWarp; ++i) {
+            warpPosRs[i] = vec4(vec3(objects[i].posRadius), float(2.0 * G * objects[i].mass / (c * c)));
+            warpSpeed[i] = length(objects[i].velocity);
+        }
         glUseProgram(gridShaderProgram);
         glUniformMatrix4fv(glGetUniformLocation(gridShaderProgram, "viewProj"),
                         1, GL_FALSE, glm::value_ptr(viewProj));
+        glUniform1i(glGetUniformLocation(gridShaderProgram, "gridSize"), gridSize);
+        glUniform1f(glGetUniformLocation(gridShaderProgram, "gridSpacing"), GRID_EXTENT / gridSize);
+        glUniform1i(glGetUniformLocation(gridShaderProgram, "numWarp"), numWarp);
+        if (numWarp > 0) {
+            glUniform4fv(glGetUniformLocation(gridShaderProgram, "warpPosRs"), numWarp, value_ptr(warpPosRs[0]));
+            glUniform1fv(glGetUniformLocation(gridShaderProgram, "warpSpeed"), numWarp, warpSpeed);
+        }
+        glUniform1i(glGetUniformLocation(gridShaderProgram, "colorMode"), int(gravityLineColorMode));
+        glUniform3fv(glGetUniformLocation(gridShaderProgram, "fixedColor"), 1, value_ptr(fixedLineColor));
+        glUniform4f(glGetUniformLocation(gridShaderProgram, "holePosRs"),
+                    SagA.position.x, SagA.position.y, SagA.position.z, float(SagA.r_s));
         glBindVertexArray(gridVAO);
 
         glDisable(GL_DEPTH_TEST);
@@ -337,19 +787,30 @@ struct Engine {
         glBindVertexArray(0);
         glEnable(GL_DEPTH_TEST);
     }
+    // the traced image, or its upscale when there is one; texture unit 0
+    void bindShownImage() {
+        glActiveTexture(GL_TEXTURE0);
+        if (upscale) {
+            glBindTexture(GL_TEXTURE_2D, displayTexture);
+            glUniform2f(glGetUniformLocation(shaderProgram, "traceSize"), float(WIDTH), float(HEIGHT));
+        } else {
+            glBindTexture(GL_TEXTURE_2D, texture);
+            glUniform2f(glGetUniformLocation(shaderProgram, "traceSize"), float(imageWidth), float(imageHeight));
+        }
+    }
     void drawFullScreenQuad() {
         glUseProgram(shaderProgram); // fragment + vertex shader
         glBindVertexArray(quadVAO);
 
-        glActiveTexture(GL_TEXTURE0);
-        glBindTexture(GL_TEXTURE_2D, texture);
+        bindShownImage();
         glUniform1i(glGetUniformLocation(shaderProgram, "screenTexture"), 0);
 
         glDisable(GL_DEPTH_TEST);  // draw as background
         glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);  // 2 triangles for quad
         glEnable(GL_DEPTH_TEST);
     }
-    GLuint CreateShaderProgram(){
+    // the full-screen quad's shaders, built into every binary
+    vector<pair<GLenum, string>> quadStages() const {
         const char* vertexShaderSource = R"(
         #version 330 core
         layout (location = 0) in vec2 aPos;  // Changed to vec2
@@ -365,218 +826,768 @@ struct Engine {
         in vec2 TexCoord;
         out vec4 FragColor;
         uniform sampler2D screenTexture;
+        uniform vec2 traceSize; // texels in use, from the lower-left corner
         void main() {
-            FragColor = texture(screenTexture, TexCoord);
+            vec2 uv = clamp(TexCoord * traceSize, vec2(0.5), traceSize - 0.5);
+            FragColor = texture(screenTexture, uv / vec2(textureSize(screenTexture, 0)));
         })";
-
-        // vertex shader
-        GLuint vertexShader = glCreateShader(GL_VERTEX_SHADER);
-        glShaderSource(vertexShader, 1, &vertexShaderSource, nullptr);
-        glCompileShader(vertexShader);
-
-        // fragment shader
-        GLuint fragmentShader = glCreateShader(GL_FRAGMENT_SHADER);
-        glShaderSource(fragmentShader, 1, &fragmentShaderSource, nullptr);
-        glCompileShader(fragmentShader);
-
-        GLuint shaderProgram = glCreateProgram();
-        glAttachShader(shaderProgram, vertexShader);
-        glAttachShader(shaderProgram, fragmentShader);
-        glLinkProgram(shaderProgram);
-
-        glDeleteShader(vertexShader);
-        glDeleteShader(fragmentShader);
-
-        return shaderProgram;
-    };
-    GLuint CreateShaderProgram(const char* vertPath, const char* fragPath) {
-        auto loadShader = [](const char* path, GLenum type) -> GLuint {
-            std::ifstream in(path);
-            if (!in.is_open()) {
-                std::cerr << "Failed to open shader: " << path << "\n";
-                exit(EXIT_FAILURE);
-            }
-            std::stringstream ss;
-            ss << in.rdbuf();
-            std::string srcStr = ss.str();
-            const char* src = srcStr.c_str();
-
-            GLuint shader = glCreateShader(type);
-            glShaderSource(shader, 1, &src, nullptr);
-            glCompileShader(shader);
-
-            GLint success;
-            glGetShaderiv(shader, GL_COMPILE_STATUS, &success);
-            if (!success) {
-                GLint logLen;
-                glGetShaderiv(shader, GL_INFO_LOG_LENGTH, &logLen);
-                std::vector<char> log(logLen);
-                glGetShaderInfoLog(shader, logLen, nullptr, log.data());
-                std::cerr << "Shader compile error (" << path << "):\n" << log.data() << "\n";
-                exit(EXIT_FAILURE);
-            }
-            return shader;
-        };
-
-        GLuint vertShader = loadShader(vertPath, GL_VERTEX_SHADER);
-        GLuint fragShader = loadShader(fragPath, GL_FRAGMENT_SHADER);
-
-        GLuint program = glCreateProgram();
-        glAttachShader(program, vertShader);
-        glAttachShader(program, fragShader);
-        glLinkProgram(program);
-
-        GLint linkSuccess;
-        glGetProgramiv(program, GL_LINK_STATUS, &linkSuccess);
-        if (!linkSuccess) {
-            GLint logLen;
-            glGetProgramiv(program, GL_INFO_LOG_LENGTH, &logLen);
-            std::vector<char> log(logLen);
-            glGetProgramInfoLog(program, logLen, nullptr, log.data());
-            std::cerr << "Shader link error:\n" << log.data() << "\n";
-            exit(EXIT_FAILURE);
+        return { { GL_VERTEX_SHADER, vertexShaderSource }, { GL_FRAGMENT_SHADER, fragmentShaderSource } };
+    }
+    // Starts every program this backend needs: cached ones load at once, the
+    // rest compile in the background. The quad and grid programs are small and
+    // needed by the first frame, so those are waited for here.
+    void startPrograms() {
+        programCache.init(shaderCacheDir);
+        if (backend != ComputeBackend::CPU && !tuneGroups) loadWorkgroup();
+        quadBuild.start(programCache, "quad", quadStages());
+        gridBuild.start(programCache, "grid.vert/grid.frag",
+                        { { GL_VERTEX_SHADER, ProgramBuild::readSource("grid.vert") },
+                          { GL_FRAGMENT_SHADER, ProgramBuild::readSource("grid.frag") } });
+        if (backend != ComputeBackend::CPU) {
+            bodyGrid = objects.size() > size_t(MAX_OBJECTS);
+            if (bodyGrid)
+                bodyGridBuild.start(programCache, "body_grid.comp",
+                                    { { GL_COMPUTE_SHADER, ProgramBuild::readSource("body_grid.comp") } });
+            computeSource = ProgramBuild::readSource("geodesic.comp");
+            computeVariant();
+            if (upscale)
+                upscaleBuild.start(programCache, "upscale.comp",
+                                   { { GL_COMPUTE_SHADER, ProgramBuild::readSource("upscale.comp") } });
         }
-
-        glDeleteShader(vertShader);
-        glDeleteShader(fragShader);
-
-        return program;
+        quadBuild.finish(programCache);
+        gridBuild.finish(programCache);
+        shaderProgram = quadBuild.program;
+        gridShaderProgram = gridBuild.program;
+        upscaleProgram = upscaleBuild.program;
     }
-    GLuint CreateComputeProgram(const char* path) {
-        // 1) read GLSL source
-        std::ifstream in(path);
-        if(!in.is_open()) {
-            std::cerr << "Failed to open compute shader: " << path << "\n";
-            exit(EXIT_FAILURE);
+    // The geodesic.comp variant for the scene as it is now (Specialization in
+    // geodesic.comp), started the first time that configuration comes up.
+    ProgramBuild& computeVariant() { return computeVariant(computeGroup); }
+    ProgramBuild& computeVariant(ivec2 group) {
+        std::ostringstream defs;
+        defs << "#define GROUP_X " << group.x << "\n#define GROUP_Y " << group.y << "\n"
+             << "#define SPEC_OBJECTS " << (bodyGrid ? 0 : std::min(objects.size(), size_t(MAX_OBJECTS))) << "\n"
+             << "#define SPEC_BODY_GRID " << bodyGrid << "\n"
+             << "#define SPEC_KERR " << (spin != 0.0f) << "\n"
+             << "#define SPEC_THICK " << (diskThickness > 0.0f) << "\n"
+             << "#define SPEC_MAX_STEPS " << cpu::MAX_STEPS << "\n";
+        auto it = computeVariants.find(defs.str());
+        if (it == computeVariants.end()) {
+            it = computeVariants.emplace(defs.str(), ProgramBuild()).first;
+            it->second.start(programCache, "geodesic.comp", { { GL_COMPUTE_SHADER, specializeSource(computeSource, defs.str()) } });
         }
-        std::stringstream ss;
-        ss << in.rdbuf();
-        std::string srcStr = ss.str();
-        const char* src = srcStr.c_str();
-
-        // 2) compile
-        GLuint cs = glCreateShader(GL_COMPUTE_SHADER);
-        glShaderSource(cs, 1, &src, nullptr);
-        glCompileShader(cs);
-        GLint ok; 
-        glGetShaderiv(cs, GL_COMPILE_STATUS, &ok);
-        if(!ok) {
-            GLint logLen;
-            glGetShaderiv(cs, GL_INFO_LOG_LENGTH, &logLen);
-            std::vector<char> log(logLen);
-            glGetShaderInfoLog(cs, logLen, nullptr, log.data());
-            std::cerr << "Compute shader compile error:\n" << log.data() << "\n";
-            exit(EXIT_FAILURE);
+        return it->second;
+    }
+    // true once the programs the trace needs are linked; polled every frame,
+    // and picks the compute variant the frame will use
+    bool programsReady() {
+        if (backend == ComputeBackend::CPU) return true;
+        ProgramBuild& variant = computeVariant();
+        bool ready = variant.ready(programCache);
+        if (ready) computeProgram = variant.program;
+        if (upscale) ready = upscaleBuild.ready(programCache) && ready;
+        if (bodyGrid) ready = bodyGridBuild.ready(programCache) && ready;
+        return ready;
+    }
+    static GLuint groupsFor(int n, int size) { return GLuint((n + size - 1) / size); }
+    // Workgroup autotuner: compiles geodesic.comp at every candidate local size
+    // (through the program cache, so a re-run mostly loads them) and times each
+    // on a fixed calibration frame - this scene, the default orbit raised off
+    // the disk plane, 400x300 - with timer queries. The size with the lowest
+    // median of TUNE_RUNS wins and is kept per GPU and driver next to the
+    // program binaries, where later launches read it back.
+    string workgroupFile() const {
+        if (programCache.dir.empty()) return "";
+        char name[40];
+        std::snprintf(name, sizeof(name), "workgroup-%016llx.txt", (unsigned long long)programCache.key({}));
+        return programCache.dir + "/" + name;
+    }
+    // Hybrid dispatches one cpu::TILE band per GPU dispatch, so a group taller
+    // than the band (or not dividing it) would spill into the next band
+    bool groupFits(ivec2 g, GLint maxInv) const {
+        return g.x * g.y <= maxInv && (backend != ComputeBackend::Hybrid || cpu::TILE % g.y == 0);
+    }
+    void loadWorkgroup() {
+        string path = workgroupFile();
+        if (path.empty()) return;
+        std::ifstream in(path);
+        GLint maxInv = 0;
+        glGetIntegerv(GL_MAX_COMPUTE_WORK_GROUP_INVOCATIONS, &maxInv);
+        int x = 0, y = 0;
+        if (in >> x >> y && x > 0 && y > 0 && groupFits(ivec2(x, y), maxInv)) {
+            computeGroup = ivec2(x, y);
+            cout << "[INFO] Workgroup " << x << "x" << y << " (tuned)\n";
         }
+    }
+    void tuneWorkgroup() {
+        const int TUNE_RUNS = 5, W = 400, H = 300;
+        const ivec2 candidates[] = { ivec2(8, 8), ivec2(16, 8), ivec2(8, 16), ivec2(16, 16),
+                                     ivec2(32, 4), ivec2(32, 8), ivec2(8, 32), ivec2(64, 4) };
+        GLint maxInv = 0;
+        glGetIntegerv(GL_MAX_COMPUTE_WORK_GROUP_INVOCATIONS, &maxInv);
+        vector<ivec2> sizes;
+        for (ivec2 g : candidates)
+            if (groupFits(g, maxInv)) {
+                sizes.push_back(g);
+                computeVariant(g);   // all compile at once
+            }
 
-        // 3) link
-        GLuint prog = glCreateProgram();
-        glAttachShader(prog, cs);
-        glLinkProgram(prog);
-        glGetProgramiv(prog, GL_LINK_STATUS, &ok);
-        if(!ok) {
-            GLint logLen;
-            glGetProgramiv(prog, GL_INFO_LOG_LENGTH, &logLen);
-            std::vector<char> log(logLen);
-            glGetProgramInfoLog(prog, logLen, nullptr, log.data());
-            std::cerr << "Compute shader link error:\n" << log.data() << "\n";
-            exit(EXIT_FAILURE);
+        Camera calib;
+        calib.elevation = 1.35f;
+        cpu::TraceParams params = makeTraceParams(calib);
+        if (bodyGrid) bodyGridBuild.finish(programCache);
+        GLuint query = 0;
+        glGenQueries(1, &query);
+        double bestMs = 1e30;
+        for (ivec2 g : sizes) {
+            ProgramBuild& build = computeVariant(g);
+            build.finish(programCache);
+            computeProgram = build.program;
+            glUseProgram(computeProgram);
+            uploadCameraUBO(calib);
+            uploadDiskUBO();
+            uploadObjectsUBO(objects);
+            uploadTraceUniforms(params, W, H);
+            glBindImageTexture(0, texture, 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_RGBA8);
+            vector<double> ms;
+            for (int run = 0; run <= TUNE_RUNS; ++run) {   // run 0 warms up
+                glBeginQuery(GL_TIME_ELAPSED, query);
+                glDispatchCompute(groupsFor(W, g.x), groupsFor(H, g.y), 1);
+                glEndQuery(GL_TIME_ELAPSED);
+                GLuint64 ns = 0;
+                glGetQueryObjectui64v(query, GL_QUERY_RESULT, &ns);
+                if (run > 0) ms.push_back(ns * 1e-6);
+            }
+            std::sort(ms.begin(), ms.end());
+            double median = ms[ms.size() / 2];
+            cout << "[TUNE] " << g.x << "x" << g.y << ": " << median << " ms\n";
+            if (median < bestMs) {
+                bestMs = median;
+                computeGroup = g;
+            }
         }
-
-        glDeleteShader(cs);
-        return prog;
+        glDeleteQueries(1, &query);
+        computeProgram = 0;
+        cout << "[TUNE] Workgroup " << computeGroup.x << "x" << computeGroup.y << " wins\n";
+        string path = workgroupFile();
+        if (!path.empty()) std::ofstream(path) << computeGroup.x << " " << computeGroup.y << "\n";
+    }
+    // time to first frame, and to the first with the traced image in it
+    void reportStartup(bool traced) {
+        if (firstTracedShown) return;
+        double ms = chrono::duration<double, std::milli>(Clock::now() - startTime).count();
+        if (!firstFrameShown) {
+            firstFrameShown = true;
+            cout << "[INFO] First frame " << ms << " ms after start\n";
+        }
+        if (!traced) return;
+        firstTracedShown = true;
+        cout << "[INFO] First traced frame " << ms << " ms after start (shader cache: "
+             << programCache.hits << " loaded, " << programCache.builds << " compiled"
+             << (programCache.parallel ? " in parallel" : "") << ")\n";
     }
     void dispatchCompute(const Camera& cam) {
-        // determine target compute‐res
-        int cw = cam.moving ? COMPUTE_WIDTH  : 200;
-        int ch = cam.moving ? COMPUTE_HEIGHT : 150;
-
-        // 1) reallocate the texture if needed
-        glBindTexture(GL_TEXTURE_2D, texture);
-        glTexImage2D(GL_TEXTURE_2D,
-                    0,                // mip
-                    GL_RGBA8,         // internal format
-                    cw,               // width
-                    ch,               // height
-                    0, GL_RGBA, 
-                    GL_UNSIGNED_BYTE, 
-                    nullptr);
+        // 1) this frame's trace resolution
+        if (resolution.budget > 0.0) {
+            COMPUTE_WIDTH = resolution.width();
+            COMPUTE_HEIGHT = resolution.height();
+        }
+        int cw = COMPUTE_WIDTH;
+        int ch = COMPUTE_HEIGHT;
+        imageWidth = temporal ? 2 * cw : cw;
+        imageHeight = temporal ? 2 * ch : ch;
+
+        if (backend == ComputeBackend::CPU) {
+            auto t0 = Clock::now();
+            dispatchComputeCPU(cam, cw, ch);
+            resolution.update(chrono::duration<double>(Clock::now() - t0).count(), 0);
+            return;
+        }
+        if (backend == ComputeBackend::Hybrid) {
+            dispatchComputeHybrid(cam, cw, ch);
+            resolution.update(max(balancer.gpuTime, balancer.cpuTime), 0);
+            return;
+        }
+        if (!frameQueries[0]) glGenQueries(FRAME_RING, frameQueries);
+        glBeginQuery(GL_TIME_ELAPSED, frameQueries[frameQuery]);
 
         // 2) bind compute program & UBOs
         glUseProgram(computeProgram);
-        uploadCameraUBO(cam);
-        uploadDiskUBO();
-        uploadObjectsUBO(objects);
+        cpu::TraceParams params = makeTraceParams(cam);
+        {
+            ProfileZone zone("uploads");
+            uploadCameraUBO(cam);
+            uploadDiskUBO();
+            uploadObjectsUBO(objects);
+            uploadTraceUniforms(params, imageWidth, imageHeight);
+        }
+        GLuint dirtyCells[4] = { 0, 0, 0, 0 }, movedObjects = 0;
+        const LensMap map = lensingCache ? lensMapState(params, dirtyCells, movedObjects) : LensMap::Stale;
+        const bool trace = map == LensMap::Stale;
+        frameTraced[frameQuery] = trace;
+        if (temporal) beginTemporalFrame(params);
+        if (upscale) bindGBuffer();
+        if (lensingCache) bindLensingMap(trace);
 
         // 3) bind it as image unit 0
         glBindImageTexture(0, texture, 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_RGBA8);
 
         // 4) dispatch grid
-        GLuint groupsX = (GLuint)std::ceil(cw / 16.0f);
-        GLuint groupsY = (GLuint)std::ceil(ch / 16.0f);
-        glDispatchCompute(groupsX, groupsY, 1);
+        GLuint groupsX = groupsFor(cw, computeGroup.x);
+        GLuint groupsY = groupsFor(ch, computeGroup.y);
+        if (!trace) {
+            if (map == LensMap::ObjectsMoved) retraceDirty(dirtyCells, movedObjects);
+            // the map now holds every ray, only colour them
+            glUniform1i(glGetUniformLocation(computeProgram, "shadeOnly"), 1);
+            glDispatchCompute(groupsX, groupsY, 1);
+            glUniform1i(glGetUniformLocation(computeProgram, "shadeOnly"), 0);
+        } else if (waveSteps > 0) {
+            dispatchWavefront(groupsX, groupsY, cw * ch);
+        } else {
+            glDispatchCompute(groupsX, groupsY, 1);
+        }
+        if (temporal) resolveTemporalFrame();
 
         // 5) sync
         glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+        if (upscale) upscaleToWindow(params);
+        glEndQuery(GL_TIME_ELAPSED);
+
+        // 6) feed the controller the oldest frame in flight (its query is next to be reused)
+        frameQuery = (frameQuery + 1) % (pipeline.depth + 1);
+        GLuint oldest = frameQueries[frameQuery];
+        GLint ready = 0;
+        if (glIsQuery(oldest)) glGetQueryObjectiv(oldest, GL_QUERY_RESULT_AVAILABLE, &ready);
+        // shade-only frames say nothing about what a trace costs
+        if (ready && frameTraced[frameQuery]) {
+            GLuint64 ns = 0;
+            glGetQueryObjectui64v(oldest, GL_QUERY_RESULT, &ns);
+            resolution.update(ns * 1e-9, pipeline.depth);
+        }
+
+        if (!dumpPath.empty() && !dumped) dumpTexture(imageWidth, imageHeight);
     }
-    void uploadCameraUBO(const Camera& cam) {
-        struct UBOData {
-            vec3 pos; float _pad0;
-            vec3 right; float _pad1;
-            vec3 up; float _pad2;
-            vec3 forward; float _pad3;
-            float tanHalfFov;
-            float aspect;
-            bool moving;
-            int _pad4;
-        } data;
-a        vec3 up = vec3(0, 1, 0); // y axis is up, so disk is in x-z plane
-        vec3 right = normalize(cross(fwd, up));
-        up = cross(right, fwd);
-
-        data.pos = cam.position();
-        data.right = right;
-        data.up = up;
-        data.forward = fwd;
-        data.tanHalfFov = tan(radians(60.0f * 0.5f));
-        data.aspect = float(WIDTH) / float(HEIGHT);
-        data.moving = cam.dragging || cam.panning;
+    // Lensing map (see that section of geodesic.comp): how much of it is still
+    // good for this frame. Remembers what the coming trace is for, and for
+    // ObjectsMoved fills in the cells under the moved objects' new bounds.
+    LensMap lensMapState(const cpu::TraceParams& p, GLuint dirtyCells[4], GLuint& moved) {
+        CameraUBO c = p.cam;
+        c.moving = lensCamera.moving;   // starting a drag alone moves nothing
+        bool sameView = lensValid && memcmp(&c, &lensCamera, sizeof(c)) == 0 && lensProjection == p.projection &&
+                        lensW == imageWidth && lensH == imageHeight && lensObjects.size() == objects.size();
+        bool inGrid = true;
+        for (size_t i = 0; sameView && i < objects.size(); ++i) {
+            if (objects[i].mass != lensMasses[i]) sameView = false;
+            else if (objects[i].posRadius != lensObjects[i]) {
+                moved |= 1u << (i & 31);
+                inGrid = inGrid && markCells(objects[i].posRadius, dirtyCells);
+            }
+        }
+        lensCamera = p.cam;
+        lensProjection = p.projection;
+        lensW = imageWidth;
+        lensH = imageHeight;
+        lensObjects.resize(objects.size());
+        lensMasses.resize(objects.size());
+        for (size_t i = 0; i < objects.size(); ++i) {
+            lensObjects[i] = objects[i].posRadius;
+            lensMasses[i] = objects[i].mass;
+        }
+        if (!sameView || !inGrid) {
+            fitCellGrid();
+            return LensMap::Stale;
+        }
+        return moved ? LensMap::ObjectsMoved : LensMap::Current;
+    }
+    // Grid for pathCells: the objects' bounds with a quarter of their extent to spare on every side.
+    void fitCellGrid() {
+        vec3 lo(1e30f), hi(-1e30f);
+        for (const ObjectData& o : objects) {
+            lo = min(lo, vec3(o.posRadius) - o.posRadius.w);
+            hi = max(hi, vec3(o.posRadius) + o.posRadius.w);
+        }
+        if (objects.empty()) lo = hi = vec3(0.0f);
+        vec3 extent = hi - lo;
+        float pad = 0.25f * std::max(std::max(extent.x, extent.y), std::max(extent.z, 1.0f));
+        cellOrigin = lo - pad;
+        cellSize = (extent + 2.0f * pad) / float(LENS_CELLS);
+    }
+    // Sets the bits of the cells an object's bounding box covers; false if it sticks out of the grid.
+    bool markCells(const vec4& posRadius, GLuint cells[4]) const {
+        vec3 lo = floor((vec3(posRadius) - posRadius.w - cellOrigin) / cellSize);
+        vec3 hi = floor((vec3(posRadius) + posRadius.w - cellOrigin) / cellSize);
+        if (lo.x < 0.0f || lo.y < 0.0f || lo.z < 0.0f) return false;
+        if (hi.x >= LENS_CELLS || hi.y >= LENS_CELLS || hi.z >= LENS_CELLS) return false;
+        for (int z = int(lo.z); z <= int(hi.z); ++z)
+            for (int y = int(lo.y); y <= int(hi.y); ++y)
+                for (int x = int(lo.x); x <= int(hi.x); ++x) {
+                    int i = x + LENS_CELLS * (y + LENS_CELLS * z);
+                    cells[i >> 5] |= 1u << (i & 31);
+                }
+        return true;
+    }
+    // Re-traces the mapped pixels the moved objects can have changed (Dirty-region
+    // re-tracing in geodesic.comp); the caller's shade pass colours them.
+    void retraceDirty(const GLuint dirtyCells[4], GLuint movedObjects) {
+        const int pixels = imageWidth * imageHeight;
+        if (dirtyCapacity < pixels) {
+            if (!dirtySSBO) glGenBuffers(1, &dirtySSBO);
+            glBindBuffer(GL_SHADER_STORAGE_BUFFER, dirtySSBO);
+            glBufferData(GL_SHADER_STORAGE_BUFFER, 28 + pixels * sizeof(GLuint), nullptr, GL_DYNAMIC_COPY);
+            dirtyCapacity = pixels;
+        }
+        const GLuint zero = 0;
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, dirtySSBO);
+        glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(zero), &zero);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 12, dirtySSBO); // binding = 12 matches shader
+        glBindBuffer(GL_DISPATCH_INDIRECT_BUFFER, dirtySSBO);
+
+        GLint passLoc = glGetUniformLocation(computeProgram, "retrace");
+        glUniform4uiv(glGetUniformLocation(computeProgram, "dirtyCells"), 1, dirtyCells);
+        glUniform1ui(glGetUniformLocation(computeProgram, "movedObjects"), movedObjects);
+        glUniform1i(glGetUniformLocation(computeProgram, "lensingMap"), 1);
+        glUniform1i(passLoc, RETRACE_MARK);
+        glDispatchCompute(groupsFor(imageWidth, computeGroup.x), groupsFor(imageHeight, computeGroup.y), 1);
+        glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+        glUniform1i(passLoc, RETRACE_SETUP);
+        glDispatchCompute(1, 1, 1);
+        glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT | GL_COMMAND_BARRIER_BIT);
+        glUniform1i(passLoc, RETRACE_TRACE);
+        glDispatchComputeIndirect(16);
+        glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+        glUniform1i(passLoc, 0);
+        glUniform1i(glGetUniformLocation(computeProgram, "lensingMap"), 0);
+    }
+    // Pixels the last dirty re-trace listed (waits for the GPU; for the stats line).
+    int lastDirtyCount() {
+        if (!dirtySSBO) return 0;
+        GLuint n = 0;
+        glMemoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, dirtySSBO);
+        glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(n), &n);
+        return int(n);
+    }
+    void bindLensingMap(bool trace) {
+        const int pixels = imageWidth * imageHeight;
+        if (lensCapacity < pixels) {
+            if (!lensSSBO) glGenBuffers(1, &lensSSBO);
+            glBindBuffer(GL_SHADER_STORAGE_BUFFER, lensSSBO);
+            glBufferData(GL_SHADER_STORAGE_BUFFER, pixels * LENS_SAMPLE_BYTES, nullptr, GL_DYNAMIC_COPY);
+            lensCapacity = pixels;
+        }
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 11, lensSSBO); // binding = 11 matches shader
+        glUniform1i(glGetUniformLocation(computeProgram, "lensingMap"), trace);
+        glUniform3fv(glGetUniformLocation(computeProgram, "cellOrigin"), 1, value_ptr(cellOrigin));
+        glUniform3fv(glGetUniformLocation(computeProgram, "cellSize"), 1, value_ptr(cellSize));
+        lensValid = true;
+    }
+    // G-buffer for upscale.comp, one GSample per image pixel
+    void bindGBuffer() {
+        const int pixels = imageWidth * imageHeight;
+        if (gbufferCapacity < pixels) {
+            if (!gbufferSSBO) glGenBuffers(1, &gbufferSSBO);
+            glBindBuffer(GL_SHADER_STORAGE_BUFFER, gbufferSSBO);
+            glBufferData(GL_SHADER_STORAGE_BUFFER, pixels * GBUFFER_SAMPLE_BYTES, nullptr, GL_DYNAMIC_COPY);
+            gbufferCapacity = pixels;
+        }
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 10, gbufferSSBO); // binding = 10 matches both shaders
+        glUniform1i(glGetUniformLocation(computeProgram, "gbuffer"), 1);
+    }
+    void upscaleToWindow(const cpu::TraceParams& p) {
+        glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT | GL_TEXTURE_FETCH_BARRIER_BIT);
+        glUseProgram(upscaleProgram);
+        glActiveTexture(GL_TEXTURE0);
+        glBindTexture(GL_TEXTURE_2D, texture);
+        glUniform1i(glGetUniformLocation(upscaleProgram, "source"), 0);
+        glUniform2i(glGetUniformLocation(upscaleProgram, "srcSize"), imageWidth, imageHeight);
+        glUniform2i(glGetUniformLocation(upscaleProgram, "dstSize"), WIDTH, HEIGHT);
+        float pixelAngle = p.projection == cpu::PROJ_EQUIRECT ? float(M_PI) / imageHeight
+                                                              : 2.0f * p.cam.tanHalfFov / imageHeight;
+        glUniform1f(glGetUniformLocation(upscaleProgram, "srcPixelAngle"), pixelAngle);
+        glBindImageTexture(1, displayTexture, 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_RGBA8);
+        glDispatchCompute((GLuint)std::ceil(WIDTH / 16.0f), (GLuint)std::ceil(HEIGHT / 16.0f), 1);
+        glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT | GL_TEXTURE_FETCH_BARRIER_BIT);
+    }
+    // Temporal reprojection (see that section of geodesic.comp): the trace
+    // dispatch covers one jittered pixel per 2x2 block of the image and records
+    // it in this frame's history buffer, the resolve pass fills in the rest.
+    void beginTemporalFrame(const cpu::TraceParams& p) {
+        const int pixels = imageWidth * imageHeight;
+        if (historyCapacity < pixels) {
+            if (!historySSBO[0]) glGenBuffers(2, historySSBO);
+            for (GLuint h : historySSBO) {
+                glBindBuffer(GL_SHADER_STORAGE_BUFFER, h);
+                glBufferData(GL_SHADER_STORAGE_BUFFER, pixels * HISTORY_SAMPLE_BYTES, nullptr, GL_DYNAMIC_COPY);
+            }
+            historyCapacity = pixels;
+            temporalFrame = 0;
+        }
+        // samples are only comparable between frames of the same image
+        bool valid = temporalFrame > 0 && prevImageW == imageWidth && prevImageH == imageHeight &&
+                     prevProjection == p.projection;
+        bool moved = prevObjects.size() != objects.size();
+        for (size_t i = 0; !moved && i < objects.size(); ++i) moved = prevObjects[i] != objects[i].posRadius;
+        prevObjects.resize(objects.size());
+        for (size_t i = 0; i < objects.size(); ++i) prevObjects[i] = objects[i].posRadius;
+
+        // old camera frame to new: the orbit camera's view turns with the scene about the hole
+        mat3 basis(p.cam.right, p.cam.up, p.cam.forward);
+        mat3 reproject = basis * transpose(prevBasis);
+        prevBasis = basis;
+        prevImageW = imageWidth;
+        prevImageH = imageHeight;
+        prevProjection = p.projection;
+
+        static const ivec2 JITTER[4] = { ivec2(0, 0), ivec2(1, 1), ivec2(1, 0), ivec2(0, 1) };
+        const ivec2 j = JITTER[temporalFrame % 4];
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 8, historySSBO[(temporalFrame + 1) & 1]); // binding = 8 matches shader
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 9, historySSBO[temporalFrame & 1]);       // binding = 9 matches shader
+        glUniform1i(glGetUniformLocation(computeProgram, "temporal"), TEMPORAL_TRACE);
+        glUniform2i(glGetUniformLocation(computeProgram, "jitter"), j.x, j.y);
+        glUniformMatrix3fv(glGetUniformLocation(computeProgram, "reproject"), 1, GL_FALSE, value_ptr(reproject));
+        glUniform1i(glGetUniformLocation(computeProgram, "historyValid"), valid);
+        glUniform1i(glGetUniformLocation(computeProgram, "objectsMoved"), moved);
+    }
+    void resolveTemporalFrame() {
+        glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+        glUniform1i(glGetUniformLocation(computeProgram, "temporal"), TEMPORAL_RESOLVE);
+        glDispatchCompute(groupsFor(imageWidth, computeGroup.x), groupsFor(imageHeight, computeGroup.y), 1);
+        glUniform1i(glGetUniformLocation(computeProgram, "temporal"), 0);
+        ++temporalFrame;
+    }
+    // Wavefront passes over two ray queues (see the Wavefront section of
+    // geodesic.comp). Nothing waits on the GPU except a read of the live count
+    // every WAVE_POLL passes, so the pass count is bounded by the step budget
+    // and empty passes dispatch zero groups.
+    void dispatchWavefront(GLuint groupsX, GLuint groupsY, int rays) {
+        if (waveCapacity < rays) {
+            if (!waveCounters) {
+                glGenBuffers(2, waveQueues);
+                glGenBuffers(1, &waveCounters);
+                glBindBuffer(GL_SHADER_STORAGE_BUFFER, waveCounters);
+                glBufferData(GL_SHADER_STORAGE_BUFFER, 7 * sizeof(GLuint), nullptr, GL_DYNAMIC_DRAW);
+            }
+            for (GLuint q : waveQueues) {
+                glBindBuffer(GL_SHADER_STORAGE_BUFFER, q);
+                glBufferData(GL_SHADER_STORAGE_BUFFER, rays * WAVE_RAY_BYTES, nullptr, GL_DYNAMIC_COPY);
+            }
+            waveCapacity = rays;
+        }
+        const GLuint zero[2] = { 0, 0 };
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, waveCounters);
+        glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(zero), zero);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 7, waveCounters); // binding = 7 matches shader
+        glBindBuffer(GL_DISPATCH_INDIRECT_BUFFER, waveCounters);
+
+        GLint modeLoc = glGetUniformLocation(computeProgram, "wavefront");
+        GLint inLoc = glGetUniformLocation(computeProgram, "waveIn");
+        GLint outLoc = glGetUniformLocation(computeProgram, "waveOut");
+        glUniform1i(glGetUniformLocation(computeProgram, "waveSteps"), waveSteps);
+
+        // generate: one invocation per pixel, first waveSteps steps, survivors to queue 0
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 5, waveQueues[1]);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 6, waveQueues[0]);
+        glUniform1i(modeLoc, WAVE_GENERATE);
+        glUniform1i(outLoc, 0);
+        glDispatchCompute(groupsX, groupsY, 1);
 
-        glBindBuffer(GL_UNIFORM_BUFFER, cameraUBO);
-        glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(UBOData), &data);
+        int cur = 0;
+        const int passes = (cpu::MAX_STEPS + waveSteps - 1) / waveSteps;
+        for (int pass = 1; pass < passes; ++pass) {
+            int next = 1 - cur;
+            glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 5, waveQueues[cur]);
+            glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 6, waveQueues[next]);
+            glUniform1i(inLoc, cur);
+            glUniform1i(outLoc, next);
+            glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+            glUniform1i(modeLoc, WAVE_SETUP);
+            glDispatchCompute(1, 1, 1);
+            glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT | GL_COMMAND_BARRIER_BIT);
+            glUniform1i(modeLoc, WAVE_EXTEND);
+            glDispatchComputeIndirect(4 * sizeof(GLuint));
+            cur = next;
+
+            if (pass % WAVE_POLL == 0) {
+                GLuint live = 0;
+                glMemoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT);
+                glGetBufferSubData(GL_DISPATCH_INDIRECT_BUFFER, cur * sizeof(GLuint), sizeof(GLuint), &live);
+                if (live == 0) break;
+            }
+        }
+        glUniform1i(modeLoc, 0);
     }
-    void uploadObjectsUBO(const vector<ObjectData>& objs) {
-        struct UBOData {
-            int   numObjects;
-            float _pad0, _pad1, _pad2;        // <-- pad out to 16 bytes
-            vec4  posRadius[16];
-            vec4  color[16];
-            float  mass[16]; 
-        } data;
-
-        size_t count = std::min(objs.size(), size_t(16));
+    void dispatchComputeHybrid(const Camera& cam, int cw, int ch) {
+        const int bands = (ch + cpu::TILE - 1) / cpu::TILE;
+        if (balancer.bands() != bands) balancer.reset(bands);
+        if (cpuFramebuffer.width != cw || cpuFramebuffer.height != ch)
+            cpuFramebuffer.resize(cw, ch);
+        if (int(bandQueries.size()) < bands) {
+            size_t have = bandQueries.size();
+            bandQueries.resize(bands);
+            glGenQueries(GLsizei(bands - have), &bandQueries[have]);
+        }
+
+        // the CPU bands stop at the GPU's star levels so both halves match
+        cpu::TraceParams params = makeTraceParams(cam);
+        params.starOrder = gpuStarOrder;
+
+        // 1) GPU bands, one dispatch + timer query each
+        const int split = balancer.split;
+        glUseProgram(computeProgram);
+        {
+            ProfileZone zone("uploads");
+            uploadCameraUBO(cam);
+            uploadDiskUBO();
+            uploadObjectsUBO(objects);
+            uploadTraceUniforms(params, cw, ch);
+        }
+        glBindImageTexture(0, texture, 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_RGBA8);
+        GLint rowLoc = glGetUniformLocation(computeProgram, "rowOffset");
+        GLuint groupsX = groupsFor(cw, computeGroup.x);
+        GLuint groupsY = groupsFor(cpu::TILE, computeGroup.y);
+        for (int b = 0; b < split; ++b) {
+            glBeginQuery(GL_TIME_ELAPSED, bandQueries[b]);
+            glUniform1i(rowLoc, b * cpu::TILE);
+            glDispatchCompute(groupsX, groupsY, 1);
+            glEndQuery(GL_TIME_ELAPSED);
+        }
+        glUniform1i(rowLoc, 0);
+        glFlush(); // get the GPU going before this thread joins the CPU pool
+
+        // 2) CPU bands on the pool while the GPU works
+        vector<double> cpuBand(bands, 0.0);
+        auto t0 = Clock::now();
+        {
+            ProfileZone zone("cpu bands");
+            cpu::dispatchCompute(*cpuPool, params, cpuFramebuffer, split * cpu::TILE, ch, &cpuBand);
+        }
+        double cpuWall = chrono::duration<double>(Clock::now() - t0).count();
+
+        // 3) composite the CPU rows into the texture the GPU bands were written to
+        int row0 = split * cpu::TILE;
+        if (row0 < ch) {
+            glMemoryBarrier(GL_TEXTURE_UPDATE_BARRIER_BIT);   // after the GPU bands' image stores
+            glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+            glBindTexture(GL_TEXTURE_2D, texture);
+            glTexSubImage2D(GL_TEXTURE_2D, 0, 0, row0, cw, ch - row0, GL_RGBA, GL_UNSIGNED_BYTE,
+                            cpuFramebuffer.rgba.data() + size_t(row0) * cw * 4);
+        }
+        glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT | GL_TEXTURE_FETCH_BARRIER_BIT);
+
+        // 4) rebalance from this frame's timings
+        vector<double> gpuBand(split, 0.0);
+        for (int b = 0; b < split; ++b) {
+            GLuint64 ns = 0;
+            glGetQueryObjectui64v(bandQueries[b], GL_QUERY_RESULT, &ns);
+            gpuBand[b] = ns * 1e-9;
+        }
+        balancer.update(gpuBand, cpuBand, cpuWall);
+
+        if (!dumpPath.empty() && !dumped) dumpTexture(cw, ch);
+    }
+    void dumpTexture(int cw, int ch) {
+        vector<uint8_t> rgba(size_t(MAX_COMPUTE_WIDTH) * MAX_COMPUTE_HEIGHT * 4);
+        glMemoryBarrier(GL_TEXTURE_UPDATE_BARRIER_BIT);
+        glBindTexture(GL_TEXTURE_2D, texture);
+        glPixelStorei(GL_PACK_ALIGNMENT, 4);
+        glGetTexImage(GL_TEXTURE_2D, 0, GL_RGBA, GL_UNSIGNED_BYTE, rgba.data());
+        // keep the traced corner, rows packed
+        for (int y = 1; y < ch; ++y)
+            memmove(&rgba[size_t(y) * cw * 4], &rgba[size_t(y) * MAX_COMPUTE_WIDTH * 4], size_t(cw) * 4);
+        dumpFrame(cw, ch, rgba.data());
+    }
+    void dispatchComputeCPU(const Camera& cam, int cw, int ch) {
+        if (cpuFramebuffer.width != cw || cpuFramebuffer.height != ch)
+            cpuFramebuffer.resize(cw, ch);
+
+        cpu::TraceParams params = makeTraceParams(cam);
+        {
+            ProfileZone zone("cpu trace");
+            cpu::dispatchCompute(*cpuPool, params, cpuFramebuffer);
+        }
+
+        if (window) {
+            glBindTexture(GL_TEXTURE_2D, texture);
+            glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+            glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, cw, ch,
+                            GL_RGBA, GL_UNSIGNED_BYTE, cpuFramebuffer.rgba.data());
+        }
+        if (!dumpPath.empty() && !dumped)
+            dumpFrame(cw, ch, cpuFramebuffer.rgba.data());
+    }
+    // without a window there is nothing to read back, the encoder gets the CPU framebuffer
+    void startRecording() {
+        bool ok = window ? capture.open(recordPath, recordFps) : capture.encoder.open(recordPath, recordFps);
+        if (ok) cout << "[INFO] Recording to " << capture.encoder.path << "\n";
+        else cerr << "[WARN] Failed to open " << recordPath << ", not recording\n";
+    }
+    void stopRecording() {
+        if (!capture.active()) return;
+        capture.finish();
+        cout << "[REC] " << capture.encoder.written << " frames written to " << capture.encoder.path << ", "
+             << capture.encoder.dropped << " dropped, " << capture.encoder.failed << " failed, "
+             << capture.stalls << " readback stalls" << endl;
+    }
+    // against the trace budget when there is one (BLACKHOLE_FRAME_BUDGET), else 60 fps
+    void dumpProfile() {
+        profiler().dump(resolution.budget > 0.0 ? resolution.budget : 1.0 / 60.0);
+    }
+    void dumpFrame(int w, int h, const uint8_t* rgba) {
+        dumped = true;
+        if (writePPM(dumpPath.c_str(), w, h, rgba))
+            cout << "[INFO] Wrote " << w << "x" << h << " frame to " << dumpPath << "\n";
+        else
+            cerr << "[WARN] Failed to write " << dumpPath << "\n";
+    }
+    CameraUBO makeCameraUBO(const Camera& cam) const {
+        CameraUBO data = cpu::makeCamera(cam.position(), cam.target, 60.0f, float(WIDTH) / float(HEIGHT));
+        data.moving = cam.dragging || cam.panning;
+        return data;
+    }
+    cpu::TraceParams makeTraceParams(const Camera& cam) const {
+        cpu::TraceParams params;
+        params.cam = makeCameraUBO(cam);
+        params.disk = makeDiskUBO();
+        params.objects = makeObjectsUBO(objects);
+        params.projection = Panorama ? cpu::PROJ_EQUIRECT : cpu::PROJ_PINHOLE;
+        params.spin = spin;
+        params.stars = stars.isOpen() ? &stars : nullptr;
+        return params;
+    }
+    DiskUBO makeDiskUBO() const {
+        DiskUBO data;
+        data.r1 = SagA.r_s * 2.2f;     // inner radius just outside the event horizon
+        data.r2 = SagA.r_s * 5.2f;     // outer radius of the disk
+        data.num = 2.0;                // number of rays
+        data.thickness = SagA.r_s * diskThickness; // gas scale height, 0 = thin disk
+        return data;
+    }
+    ObjectsUBO makeObjectsUBO(const vector<ObjectData>& objs) const {
+        ObjectsUBO data = {};
+        size_t count = std::min(objs.size(), size_t(MAX_OBJECTS));
         data.numObjects = static_cast<int>(count);
 
         for (size_t i = 0; i < count; ++i) {
             data.posRadius[i] = objs[i].posRadius;
             data.color[i] = objs[i].color;
-            data.mass[i] = objs[i].mass;
+            data.mass[i].x = objs[i].mass;
         }
-
-        // Upload
-        glBindBuffer(GL_UNIFORM_BUFFER, objectsUBO);
-        glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(data), &data);
+        return data;
+    }
+    void uploadCameraUBO(const Camera& cam) {
+        CameraUBO data = makeCameraUBO(cam);
+        cameraUBO.update(&data, sizeof(data), pipeline);
+        cameraUBO.bindBase(1); // binding = 1 matches shader
+    }
+    void uploadObjectsUBO(const vector<ObjectData>& objs) {
+        ObjectsUBO data = makeObjectsUBO(objs);
+        objectsUBO.update(&data, sizeof(data), pipeline);
+        objectsUBO.bindBase(3); // binding = 3 matches shader
+        if (bodyGrid) uploadBodies(objs);
+    }
+    // Every object as a Body (Body grid in geodesic.comp), re-binned whenever
+    // one moved. Leaves computeProgram current with the grid's uniforms set.
+    void uploadBodies(const vector<ObjectData>& objs) {
+        vector<vec4> data(2 * objs.size());
+        for (size_t i = 0; i < objs.size(); ++i) {
+            data[2 * i] = objs[i].posRadius;
+            data[2 * i + 1] = objs[i].color;
+        }
+        const GLsizeiptr bytes = data.size() * sizeof(vec4);
+        if (bodiesSSBO.slotBytes < bytes) {
+            if (bodiesSSBO.buffer) glDeleteBuffers(1, &bodiesSSBO.buffer);
+            bodiesSSBO = UploadStream();
+            bodiesSSBO.init(GL_SHADER_STORAGE_BUFFER, bytes);
+        }
+        bool moved = bodiesSSBO.update(data.data(), bytes, pipeline);
+        bodiesSSBO.bindBase(13); // binding = 13 matches both shaders
+        if (moved) buildBodyGrid(objs);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 14, bodyGridSSBO); // binding = 14 matches both shaders
+        glUseProgram(computeProgram);
+        glUniform3fv(glGetUniformLocation(computeProgram, "bodyGridOrigin"), 1, value_ptr(bodyGridOrigin));
+        glUniform3fv(glGetUniformLocation(computeProgram, "bodyCellSize"), 1, value_ptr(bodyCellSize));
+        glUniform3i(glGetUniformLocation(computeProgram, "bodyGridDims"), bodyGridDims[0], bodyGridDims[1], bodyGridDims[2]);
+        glUniform1f(glGetUniformLocation(computeProgram, "bodiesFar"), bodiesFar);
+    }
+    // Fits the grid to the bodies' bounds here, about one body per cell and
+    // cells no smaller than a body, and has body_grid.comp bin them.
+    void buildBodyGrid(const vector<ObjectData>& objs) {
+        const int BODY_GRID_MAX = 64;   // cells per axis
+        vec3 lo(1e30f), hi(-1e30f);
+        float radiusSum = 0.0f;
+        bodiesFar = 0.0f;
+        for (const ObjectData& o : objs) {
+            lo = min(lo, vec3(o.posRadius) - o.posRadius.w);
+            hi = max(hi, vec3(o.posRadius) + o.posRadius.w);
+            radiusSum += o.posRadius.w;
+            bodiesFar = std::max(bodiesFar, length(vec3(o.posRadius)) + o.posRadius.w);
+        }
+        const float n = float(objs.size());
+        vec3 extent = max(hi - lo, vec3(1.0f));
+        float h = std::max(std::cbrt(extent.x * extent.y * extent.z / n), 2.0f * radiusSum / n);
+        for (int k = 0; k < 3; ++k) bodyGridDims[k] = glm::clamp(int(std::ceil(extent[k] / h)), 1, BODY_GRID_MAX);
+        bodyGridOrigin = lo;
+        bodyCellSize = extent / vec3(float(bodyGridDims[0]), float(bodyGridDims[1]), float(bodyGridDims[2]));
+
+        // cell references, counted the way body_grid.comp bins them
+        const int cells = bodyGridDims[0] * bodyGridDims[1] * bodyGridDims[2];
+        size_t refs = 0;
+        for (const ObjectData& o : objs) {
+            size_t span = 1;
+            for (int k = 0; k < 3; ++k) {
+                int a = glm::clamp(int(std::floor((o.posRadius[k] - o.posRadius.w - lo[k]) / bodyCellSize[k])), 0, bodyGridDims[k] - 1);
+                int b = glm::clamp(int(std::floor((o.posRadius[k] + o.posRadius.w - lo[k]) / bodyCellSize[k])), 0, bodyGridDims[k] - 1);
+                span *= size_t(b - a + 1);
+            }
+            refs += span;
+        }
+        const GLsizeiptr bytes = GLsizeiptr(cells + refs + refs / 8 + 64) * sizeof(GLuint);
+        if (bodyGridCapacity < bytes) {
+            if (!bodyGridSSBO) glGenBuffers(1, &bodyGridSSBO);
+            glBindBuffer(GL_SHADER_STORAGE_BUFFER, bodyGridSSBO);
+            glBufferData(GL_SHADER_STORAGE_BUFFER, bytes, nullptr, GL_DYNAMIC_COPY);
+            bodyGridCapacity = bytes;
+        }
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, bodyGridSSBO);
+        glClearBufferSubData(GL_SHADER_STORAGE_BUFFER, GL_R32UI, 0, cells * sizeof(GLuint), GL_RED_INTEGER,
+                             GL_UNSIGNED_INT, nullptr);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 14, bodyGridSSBO);
+
+        GLuint prog = bodyGridBuild.program;
+        glUseProgram(prog);
+        glUniform1i(glGetUniformLocation(prog, "bodyCount"), int(objs.size()));
+        glUniform3fv(glGetUniformLocation(prog, "bodyGridOrigin"), 1, value_ptr(bodyGridOrigin));
+        glUniform3fv(glGetUniformLocation(prog, "bodyCellSize"), 1, value_ptr(bodyCellSize));
+        glUniform3i(glGetUniformLocation(prog, "bodyGridDims"), bodyGridDims[0], bodyGridDims[1], bodyGridDims[2]);
+        GLint passLoc = glGetUniformLocation(prog, "pass");
+        const GLuint groups = groupsFor(int(objs.size()), 256);
+        glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);   // last frame's trace is done reading the grid
+        glUniform1i(passLoc, 0);   // COUNT
+        glDispatchCompute(groups, 1, 1);
+        glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+        glUniform1i(passLoc, 1);   // SCAN
+        glDispatchCompute(1, 1, 1);
+        glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+        glUniform1i(passLoc, 2);   // FILL
+        glDispatchCompute(groups, 1, 1);
+        glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
     }
     void uploadDiskUBO() {
-        // disk
-        float r1 = SagA.r_s * 2.2f;    // inner radius just outside the event horizon
-        float r2 = SagA.r_s * 5.2f;   // outer radius of the disk
-        float num = 2.0;               // number of rays
-        float thickness = 1e9f;          // padding for std140 alignment
-        float diskData[4] = { r1, r2, num, thickness };
-
-        glBindBuffer(GL_UNIFORM_BUFFER, diskUBO);
-        glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(diskData), diskData);
+        DiskUBO data = makeDiskUBO();
+        diskUBO.update(&data, sizeof(data), pipeline);
+        diskUBO.bindBase(2); // binding = 2 matches compute shader
+    }
+    void uploadTraceUniforms(const cpu::TraceParams& p, int cw, int ch) {
+        glUniform1i(glGetUniformLocation(computeProgram, "projection"), p.projection);
+        glUniform1f(glGetUniformLocation(computeProgram, "spin"), p.spin);
+        glUniform1i(glGetUniformLocation(computeProgram, "starOrder"), gpuStarOrder);
+        glUniform1f(glGetUniformLocation(computeProgram, "starFootprint"), cpu::pixelFootprint(p, cw, ch));
+        glUniform1f(glGetUniformLocation(computeProgram, "starExposure"), p.starExposure);
+        glUniform2i(glGetUniformLocation(computeProgram, "resolution"), cw, ch);
+        // the CPU bands of the hybrid backend only know the classic colours
+        glUniform1i(glGetUniformLocation(computeProgram, "diskColorMode"),
+                    backend == ComputeBackend::GPU ? DiskColorMode : 0);
+        glUniform1f(glGetUniformLocation(computeProgram, "diskTime"), float(glfwGetTime()));
     }
     
     vector<GLuint> QuadVAO(){
@@ -610,15 +1621,12 @@ a        vec3 up = vec3(0, 1, 0); // y axis is up, so disk is in x-z plane
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
         glBindTexture(GL_TEXTURE_2D, texture);
-        glTexImage2D(GL_TEXTURE_2D,
-                    0,             // mip
-                    GL_RGBA8,      // internal format
-                    COMPUTE_WIDTH,
-                    COMPUTE_HEIGHT,
-                    0,
-                    GL_RGBA,
-                    GL_UNSIGNED_BYTE,
-                    nullptr);
+        // allocated once at the largest trace size, every frame writes its lower-left cw x ch
+        if (backend == ComputeBackend::CPU) // GL 3.3 context, no immutable storage
+            glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, MAX_COMPUTE_WIDTH, MAX_COMPUTE_HEIGHT, 0,
+                         GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+        else
+            glTexStorage2D(GL_TEXTURE_2D, 1, GL_RGBA8, MAX_COMPUTE_WIDTH, MAX_COMPUTE_HEIGHT);
         vector<GLuint> VAOtexture = {VAO, texture};
         return VAOtexture;
     }
@@ -627,8 +1635,7 @@ a        vec3 up = vec3(0, 1, 0); // y axis is up, so disk is in x-z plane
         glUseProgram(shaderProgram);
         glBindVertexArray(quadVAO);
         // make sure your fragment shader samples from texture unit 0:
-        glActiveTexture(GL_TEXTURE0);
-        glBindTexture(GL_TEXTURE_2D, texture);
+        bindShownImage();
         glDrawArrays(GL_TRIANGLES, 0, 6);
         glfwSwapBuffers(window);
         glfwPollEvents();
@@ -662,13 +1669,40 @@ void setupCameraCallbacks(GLFWwindow* window) {
             if (key == GLFW_KEY_1) gravityLineColorMode = GravityLineColorMode::Fixed;
             if (key == GLFW_KEY_2) gravityLineColorMode = GravityLineColorMode::Distance;
             if (key == GLFW_KEY_3) gravityLineColorMode = GravityLineColorMode::Velocity;
+            if (key == GLFW_KEY_F9 && profiler().enabled) profiler().dumpRequested = true;
         }
     });
 }
 
 
+int runHeadless() {
+    for (int i = 0; i < engine.headlessFrames; ++i) {
+        auto f0 = Clock::now();
+        ProfileZone zone("frame");
+        engine.dispatchCompute(camera);
+        double sec = chrono::duration<double>(Clock::now() - f0).count();
+        double rays = double(engine.cpuFramebuffer.width) * engine.cpuFramebuffer.height;
+        cout << "[CPU] frame " << i << ": " << sec * 1000.0 << " ms, "
+             << rays / sec / 1e6 << " Mrays/s\n";
+        if (engine.capture.active()) {
+            const CpuFramebuffer& fb = engine.cpuFramebuffer;
+            CapturedFrame frame = engine.capture.encoder.take(fb.width, fb.height);
+            frame.bottomUp = true;
+            memcpy(frame.rgba.data(), fb.rgba.data(), frame.rgba.size());
+            engine.capture.encoder.submit(std::move(frame));
+        }
+    }
+    engine.stopRecording();
+    if (profiler().enabled) {
+        gpuProfiler().flush();
+        engine.dumpProfile();
+    }
+    return 0;
+}
+
 // -- MAIN -- //
 int main() {
+    if (engine.headlessFrames > 0) return runHeadless();
     setupCameraCallbacks(engine.window);
     vector<unsigned char> pixels(engine.WIDTH * engine.HEIGHT * 3);
 
@@ -678,6 +1712,8 @@ int main() {
     double lastTime = glfwGetTime();
     int   renderW  = 800, renderH = 600, numSteps = 80000;
     while (!glfwWindowShouldClose(engine.window)) {
+        ProfileZone frameZone("frame");
+        engine.pipeline.beginFrame();
         glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
         glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
@@ -685,8 +1721,10 @@ int main() {
         double dt    = now - lastTime;
         lastTime     = now;
 
-        // Gravity simulation (improved stability)
-        for (auto& obj : objects) {
+        // Gravity simulation (improved stability), skipped outright when off so
+        // a BLACKHOLE_CLUSTER scene doesn't pay for the O(N^2) pair loop
+        ProfileZone physicsZone("physics");
+        if (Gravity) for (auto& obj : objects) {
             for (auto& obj2 : objects) {
                 if (&obj == &obj2) continue;
                 float dx  = obj2.posRadius.x - obj.posRadius.x;
@@ -725,32 +1763,76 @@ int main() {
             }
         }
 
+        physicsZone.stop();
+
         // Grid mesh and rendering
-        engine.generateGrid(objects);
         mat4 view = lookAt(camera.position(), camera.target, vec3(0,1,0));
-        mat4 proj = perspective(radians(60.0f), float(engine.COMPUTE_WIDTH)/engine.COMPUTE_HEIGHT, 1e9f, 1e14f);
+        mat4 proj = perspective(radians(60.0f), float(engine.WIDTH)/engine.HEIGHT, 1e9f, 1e14f);
         mat4 viewProj = proj * view;
-        engine.drawGrid(viewProj);
+        {
+            ProfileZone zone("grid");
+            GpuZone gpu("grid");
+            engine.drawGrid(viewProj, objects);
+        }
 
-        // Raytracer
+        // Raytracer; until its programs are built the grid alone stands in
         glViewport(0, 0, engine.WIDTH, engine.HEIGHT);
-        engine.dispatchCompute(camera);
-        engine.drawFullScreenQuad();
+        const bool traced = engine.programsReady();
+        if (traced) {
+            {
+                ProfileZone zone("dispatchCompute");
+                GpuZone gpu("trace");
+                engine.dispatchCompute(camera);
+            }
+            ProfileZone zone("quad");
+            GpuZone gpu("quad");
+            engine.drawFullScreenQuad();
+        }
 
         // FPS counter
         framesCount++;
         double tNow = chrono::duration<double>(Clock::now().time_since_epoch()).count();
         if (tNow - lastPrintTime >= 1.0) {
             cout << "FPS: " << framesCount / (tNow - lastPrintTime) << endl;
+            engine.pipeline.printStats();
+            if (engine.capture.active())
+                cout << "[REC] " << engine.capture.encoder.written << " frames written, "
+                     << engine.capture.encoder.dropped << " dropped" << endl;
+            if (engine.resolution.budget > 0.0)
+                cout << "[RES] tracing " << engine.COMPUTE_WIDTH << "x" << engine.COMPUTE_HEIGHT << endl;
+            if (engine.lensingCache && Gravity)
+                cout << "[LENS] last object move re-traced " << engine.lastDirtyCount() << " of "
+                     << engine.imageWidth * engine.imageHeight << " pixels" << endl;
+            if (engine.backend == ComputeBackend::Hybrid) {
+                const BandBalancer& bb = engine.balancer;
+                cout << "[HYBRID] GPU bands 0-" << bb.split - 1 << " (" << bb.gpuTime * 1000.0
+                     << " ms), CPU bands " << bb.split << "-" << bb.bands() - 1 << " ("
+                     << bb.cpuTime * 1000.0 << " ms)" << endl;
+            }
             framesCount = 0;
             lastPrintTime = tNow;
         }
 
-        // Present to screen
+        // Present to screen; a recording reads the finished frame back first
+        {
+            ProfileZone zone("capture");
+            engine.capture.grab(engine.WIDTH, engine.HEIGHT);
+        }
+        ProfileZone presentZone("present");
+        engine.pipeline.endFrame();
         glfwSwapBuffers(engine.window);
+        presentZone.stop();
+        engine.reportStartup(traced);
         glfwPollEvents();
+        frameZone.stop();   // the dump isn't part of the frame
+        if (profiler().dumpRequested.exchange(false)) engine.dumpProfile();
     }
 
+    engine.stopRecording();
+    if (profiler().enabled) {
+        gpuProfiler().flush();
+        engine.dumpProfile();
+    }
     glfwDestroyWindow(engine.window);
     glfwTerminate();
     return 0;
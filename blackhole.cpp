@@ -0,0 +1,195 @@
+#define BH_BUILDING
+#include "blackhole.h"
+#include "geodesic_cpu.h"
+#include <new>
+#include <cstdlib>
+
+// libblackhole: scene/camera translation and pool plumbing around geodesic_cpu.h.
+// Nothing here is global; all state hangs off a RendererImpl.
+
+namespace bh {
+
+const double C_LIGHT = 299792458.0;
+const double G_NEWTON = 6.67430e-11;
+
+// Caller pool behind the tracer's TaskRunner interface.
+struct ExecutorRunner : TaskRunner {
+    Executor* pool = nullptr;
+    unsigned size() const override { return std::max(pool->concurrency(), 1u); }
+    void parallelFor(int count, const std::function<void(int)>& fn) override { pool->parallelFor(count, fn); }
+};
+
+// C function-pointer pool behind the C++ Executor interface.
+struct CExecutor : Executor {
+    bh_executor ex;
+    explicit CExecutor(const bh_executor& e) : ex(e) {}
+    unsigned concurrency() const override { return ex.concurrency; }
+    void parallelFor(int count, const std::function<void(int)>& fn) override {
+        ex.parallel_for(ex.user, count, [](void* ctx, int i) {
+            (*static_cast<const std::function<void(int)>*>(ctx))(i);
+        }, const_cast<std::function<void(int)>*>(&fn));
+    }
+};
+
+struct RendererImpl {
+    std::unique_ptr<ThreadPool> ownPool;
+    ExecutorRunner callerPool;
+    TaskRunner* pool = nullptr;
+    cpu::TraceParams params;
+    CpuFramebuffer target;
+    std::unique_ptr<StarCatalog> stars;
+    float starExposure = 100.0f;
+};
+
+Renderer::Renderer(Executor* pool, unsigned threads) : impl(new RendererImpl()) {
+    if (pool) {
+        impl->callerPool.pool = pool;
+        impl->pool = &impl->callerPool;
+    } else {
+        impl->ownPool.reset(new ThreadPool(threads ? threads : std::thread::hardware_concurrency()));
+        impl->pool = impl->ownPool.get();
+    }
+    bh_scene scene;
+    bh_scene_default(&scene);
+    setScene(scene);
+}
+Renderer::~Renderer() = default;
+Renderer::Renderer(Renderer&&) noexcept = default;
+Renderer& Renderer::operator=(Renderer&&) noexcept = default;
+
+bh_status Renderer::setScene(const bh_scene& scene) {
+    if (scene.num_objects < 0) return BH_INVALID_ARGUMENT;
+    if (scene.num_objects > BH_MAX_OBJECTS) return BH_TOO_MANY_OBJECTS;
+    if (!(scene.black_hole_mass > 0.0) || scene.disk_inner > scene.disk_outer) return BH_INVALID_ARGUMENT;
+    if (!(std::fabs(scene.spin) < 1.0f) || !(scene.disk_thickness >= 0.0f)) return BH_INVALID_ARGUMENT;
+
+    cpu::TraceParams p = {};
+    p.rs = float(2.0 * G_NEWTON * scene.black_hole_mass / (C_LIGHT * C_LIGHT));
+    p.spin = scene.spin;
+    p.disk.r1 = scene.disk_inner;
+    p.disk.r2 = scene.disk_outer;
+    p.disk.num = 2.0f;
+    p.disk.thickness = scene.disk_thickness;
+    p.objects.numObjects = scene.num_objects;
+    for (int i = 0; i < scene.num_objects; ++i) {
+        const bh_object& o = scene.objects[i];
+        p.objects.posRadius[i] = glm::vec4(o.position[0], o.position[1], o.position[2], o.radius);
+        p.objects.color[i] = glm::vec4(o.color[0], o.color[1], o.color[2], o.color[3]);
+        p.objects.mass[i].x = o.mass;
+    }
+    impl->params = p;
+    return BH_OK;
+}
+
+bh_status Renderer::setStarCatalog(const char* path, float exposure) {
+    if (!(exposure > 0.0f)) return BH_INVALID_ARGUMENT;
+    if (!path) {
+        impl->stars.reset();
+        return BH_OK;
+    }
+    std::unique_ptr<StarCatalog> stars(new StarCatalog());
+    if (!stars->open(path)) return BH_IO_ERROR;
+    impl->stars = std::move(stars);
+    impl->starExposure = exposure;
+    return BH_OK;
+}
+
+bh_status Renderer::render(const bh_camera& camera, const bh_image& image) {
+    const int W = image.width, H = image.height;
+    if (!image.pixels || W <= 0 || H <= 0) return BH_INVALID_ARGUMENT;
+    if (std::abs(image.row_stride) < std::ptrdiff_t(W) * 4) return BH_INVALID_ARGUMENT;
+    if (camera.projection < BH_PROJECTION_PINHOLE || camera.projection > BH_PROJECTION_CUBE_FACE)
+        return BH_INVALID_ARGUMENT;
+    if (camera.projection == BH_PROJECTION_CUBE_FACE && (W != H || camera.face < 0 || camera.face > 5))
+        return BH_INVALID_ARGUMENT;
+
+    glm::vec3 pos(camera.position[0], camera.position[1], camera.position[2]);
+    glm::vec3 target(camera.target[0], camera.target[1], camera.target[2]);
+    glm::vec3 fwd = target - pos;
+    // makeCamera takes +y as up, so the view can't point along the y axis
+    if (glm::length(glm::cross(fwd, glm::vec3(0, 1, 0))) <= 1e-6f * glm::length(fwd))
+        return BH_INVALID_ARGUMENT;
+
+    cpu::TraceParams p = impl->params;
+    p.cam = cpu::makeCamera(pos, target, camera.fov_y, float(W) / float(H));
+    p.projection = camera.projection;
+    p.face = camera.face;
+    p.stars = impl->stars.get();
+    p.starExposure = impl->starExposure;
+
+    // the tracer counts rows bottom up, the caller's row 0 is the top
+    impl->target.wrap(image.pixels + std::ptrdiff_t(H - 1) * image.row_stride, W, H, -image.row_stride);
+    cpu::dispatchCompute(*impl->pool, p, impl->target);
+    return BH_OK;
+}
+
+} // namespace bh
+
+// -- C API -- //
+struct bh_renderer {
+    std::unique_ptr<bh::CExecutor> executor;
+    std::unique_ptr<bh::Renderer> renderer;
+};
+
+extern "C" {
+
+bh_renderer* bh_renderer_create(const bh_executor* executor, unsigned threads) {
+    if (executor && !executor->parallel_for) return nullptr;
+    try {
+        std::unique_ptr<bh_renderer> r(new bh_renderer());
+        if (executor) r->executor.reset(new bh::CExecutor(*executor));
+        r->renderer.reset(new bh::Renderer(r->executor.get(), threads));
+        return r.release();
+    } catch (...) {   // bad_alloc, or system_error from starting the pool
+        return nullptr;
+    }
+}
+
+void bh_renderer_destroy(bh_renderer* renderer) {
+    delete renderer;
+}
+
+void bh_scene_default(bh_scene* scene) {
+    if (!scene) return;
+    *scene = bh_scene();
+    scene->black_hole_mass = 8.54e36; // Sagittarius A*
+    const float rs = float(2.0 * bh::G_NEWTON * scene->black_hole_mass / (bh::C_LIGHT * bh::C_LIGHT));
+    scene->disk_inner = rs * 2.2f;
+    scene->disk_outer = rs * 5.2f;
+    const bh_object stars[] = {
+        { { 4e11f, 0.0f, 0.0f }, 4e10f, { 1, 1, 0, 1 }, 1.98892e30f },
+        { { 0.0f, 0.0f, 4e11f }, 4e10f, { 1, 0, 0, 1 }, 1.98892e30f },
+    };
+    scene->num_objects = 2;
+    scene->objects[0] = stars[0];
+    scene->objects[1] = stars[1];
+}
+
+bh_status bh_renderer_set_scene(bh_renderer* renderer, const bh_scene* scene) {
+    if (!renderer || !scene) return BH_INVALID_ARGUMENT;
+    try {
+        return renderer->renderer->setScene(*scene);
+    } catch (...) {
+        return BH_OUT_OF_RESOURCES;
+    }
+}
+
+bh_status bh_renderer_set_star_catalog(bh_renderer* renderer, const char* path, float exposure) {
+    if (!renderer) return BH_INVALID_ARGUMENT;
+    try {
+        return renderer->renderer->setStarCatalog(path, exposure);
+    } catch (...) {
+        return BH_OUT_OF_RESOURCES;
+    }
+}
+
+bh_status bh_render(bh_renderer* renderer, const bh_camera* camera, const bh_image* image) {
+    if (!renderer || !camera || !image) return BH_INVALID_ARGUMENT;
+    try {
+        return renderer->renderer->render(*camera, *image);
+    } catch (...) {
+        return BH_OUT_OF_RESOURCES;
+    }
+}
+
+} // extern "C"
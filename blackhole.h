@@ -0,0 +1,140 @@
+#ifndef BLACKHOLE_H
+#define BLACKHOLE_H
+/* libblackhole: the geodesic tracer behind BlackHole3D/BlackHoleRender as an
+ * embeddable library. No GL, no globals: every bh_renderer owns its scene and
+ * (unless given one) its thread pool, so any number can live in one process.
+ *
+ * A renderer may be used from one thread at a time; different renderers are
+ * independent. Images are RGBA8 in caller-owned memory, written in place. */
+#include <stddef.h>
+#include <stdint.h>
+
+#if defined(_WIN32) && defined(BH_SHARED)
+#  ifdef BH_BUILDING
+#    define BH_API __declspec(dllexport)
+#  else
+#    define BH_API __declspec(dllimport)
+#  endif
+#elif defined(__GNUC__)
+#  define BH_API __attribute__((visibility("default")))
+#else
+#  define BH_API
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef enum bh_status {
+    BH_OK = 0,
+    BH_INVALID_ARGUMENT,
+    BH_TOO_MANY_OBJECTS,
+    BH_OUT_OF_RESOURCES,  /* memory or worker threads ran out */
+    BH_IO_ERROR
+} bh_status;
+
+#define BH_MAX_OBJECTS 16
+
+enum {
+    BH_PROJECTION_PINHOLE = 0,
+    BH_PROJECTION_EQUIRECT = 1,  /* 360 x 180, 2:1 images */
+    BH_PROJECTION_CUBE_FACE = 2  /* one square face, see bh_camera.face */
+};
+
+typedef struct bh_object {
+    float position[3];  /* m */
+    float radius;       /* m */
+    float color[4];     /* linear RGBA, 0..1 */
+    float mass;         /* kg */
+} bh_object;
+
+/* Units are SI. bh_scene_default() gives BlackHole3D's Sagittarius A* scene. */
+typedef struct bh_scene {
+    double black_hole_mass;     /* kg */
+    float spin;                 /* Kerr a = J/M about +y, -1 < spin < 1; 0 = Schwarzschild */
+    float disk_inner, disk_outer; /* accretion disk radii in the y = 0 plane (m) */
+    float disk_thickness;       /* scale height of a volumetric disk (m); 0 = thin disk */
+    int num_objects;
+    bh_object objects[BH_MAX_OBJECTS];
+} bh_scene;
+
+typedef struct bh_camera {
+    float position[3];
+    float target[3];
+    float fov_y;        /* degrees, pinhole only */
+    int projection;     /* BH_PROJECTION_* */
+    int face;           /* 0..5 = front, right, back, left, up, down */
+} bh_camera;
+
+/* Row 0 is the top of the image; row_stride is in bytes and may be negative. */
+typedef struct bh_image {
+    uint8_t* pixels;
+    int width, height;
+    ptrdiff_t row_stride;
+} bh_image;
+
+/* Optional caller thread pool. parallel_for must call task(task_ctx, i) for
+ * every i in [0, count), from any threads, and return once they all have. */
+typedef struct bh_executor {
+    void (*parallel_for)(void* user, int count, void (*task)(void* task_ctx, int index), void* task_ctx);
+    void* user;
+    unsigned concurrency;
+} bh_executor;
+
+typedef struct bh_renderer bh_renderer;
+
+/* executor may be NULL: the renderer then starts `threads` workers of its own
+ * (0 = one per core). The executor is copied but must outlive the renderer.
+ * Returns NULL if the renderer can't be set up. No C++ exception crosses the
+ * C API; the calls below return BH_OUT_OF_RESOURCES instead. */
+BH_API bh_renderer* bh_renderer_create(const bh_executor* executor, unsigned threads);
+BH_API void bh_renderer_destroy(bh_renderer* renderer);
+
+BH_API void bh_scene_default(bh_scene* scene);
+BH_API bh_status bh_renderer_set_scene(bh_renderer* renderer, const bh_scene* scene);
+BH_API bh_status bh_render(bh_renderer* renderer, const bh_camera* camera, const bh_image* image);
+/* Star field behind the hole from a BuildStarCatalog file, memory-mapped so
+ * only the parts rays look at are read. path NULL = black background again.
+ * exposure scales star flux for display (about 100 shows magnitude 6 stars). */
+BH_API bh_status bh_renderer_set_star_catalog(bh_renderer* renderer, const char* path, float exposure);
+
+#ifdef __cplusplus
+} /* extern "C" */
+
+#include <functional>
+#include <memory>
+
+namespace bh {
+
+// C++ face of the same API. A Renderer is movable, not copyable.
+struct Executor {
+    virtual ~Executor() {}
+    virtual unsigned concurrency() const = 0;
+    virtual void parallelFor(int count, const std::function<void(int)>& fn) = 0;
+};
+
+struct RendererImpl;
+
+class BH_API Renderer {
+public:
+    // pool may be null: the renderer starts `threads` workers (0 = one per core).
+    // A caller pool must outlive the renderer and may be shared between renderers.
+    explicit Renderer(Executor* pool = nullptr, unsigned threads = 0);
+    ~Renderer();
+    Renderer(Renderer&&) noexcept;
+    Renderer& operator=(Renderer&&) noexcept;
+    Renderer(const Renderer&) = delete;
+    Renderer& operator=(const Renderer&) = delete;
+
+    bh_status setScene(const bh_scene& scene);
+    bh_status setStarCatalog(const char* path, float exposure = 100.0f);
+    bh_status render(const bh_camera& camera, const bh_image& image);
+
+private:
+    std::unique_ptr<RendererImpl> impl;
+};
+
+} // namespace bh
+#endif /* __cplusplus */
+
+#endif /* BLACKHOLE_H */
@@ -0,0 +1,120 @@
+/* Smoke test for libblackhole's C API (run by CTest as blackhole_c_api).
+ * Plain C on purpose: it also checks that blackhole.h is usable from C. */
+#include "blackhole.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static int failures = 0;
+
+#define CHECK(cond) do { \
+    if (!(cond)) { fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); ++failures; } \
+} while (0)
+
+enum { W = 32, H = 16, PAD = 8, STRIDE = W * 4 + PAD };
+
+/* Renders into a W x H image whose rows lie STRIDE bytes apart in buf, one
+ * spare row before and after; negative flips the rows in memory. */
+static bh_status renderInto(bh_renderer* r, const bh_camera* cam, uint8_t* buf, int negative) {
+    bh_image img;
+    img.width = W;
+    img.height = H;
+    img.row_stride = negative ? -(ptrdiff_t)STRIDE : (ptrdiff_t)STRIDE;
+    img.pixels = buf + STRIDE * (negative ? H : 1);
+    return bh_render(r, cam, &img);
+}
+
+static const uint8_t* rowOf(const uint8_t* buf, int y, int negative) {
+    return buf + STRIDE * (negative ? H - y : 1 + y);
+}
+
+int main(void) {
+    const size_t bytes = STRIDE * (H + 2);
+    uint8_t* a = (uint8_t*)malloc(bytes);
+    uint8_t* b = (uint8_t*)malloc(bytes);
+    uint8_t* c = (uint8_t*)malloc(bytes);
+    bh_renderer* r = bh_renderer_create(NULL, 2);
+    bh_scene scene;
+    bh_camera cam;
+    size_t i, untouched = 0;
+    int y, top = 0, bottom = 0;
+
+    CHECK(r != NULL);
+    if (!r || !a || !b || !c) return EXIT_FAILURE;
+
+    /* -- Scenes -- */
+    bh_scene_default(&scene);
+    CHECK(bh_renderer_set_scene(r, &scene) == BH_OK);
+    CHECK(bh_renderer_set_scene(r, NULL) == BH_INVALID_ARGUMENT);
+    CHECK(bh_renderer_set_scene(NULL, &scene) == BH_INVALID_ARGUMENT);
+    scene.num_objects = BH_MAX_OBJECTS + 1;
+    CHECK(bh_renderer_set_scene(r, &scene) == BH_TOO_MANY_OBJECTS);
+    scene.num_objects = -1;
+    CHECK(bh_renderer_set_scene(r, &scene) == BH_INVALID_ARGUMENT);
+    bh_scene_default(&scene);
+    scene.black_hole_mass = 0.0;
+    CHECK(bh_renderer_set_scene(r, &scene) == BH_INVALID_ARGUMENT);
+    bh_scene_default(&scene);
+    scene.disk_inner = scene.disk_outer * 2.0f;
+    CHECK(bh_renderer_set_scene(r, &scene) == BH_INVALID_ARGUMENT);
+
+    /* -- Star catalog -- */
+    CHECK(bh_renderer_set_star_catalog(r, "no/such/catalog.stars", 100.0f) == BH_IO_ERROR);
+    CHECK(bh_renderer_set_star_catalog(r, NULL, 100.0f) == BH_OK);
+
+    /* -- Rendering -- */
+    /* one red object above the hole, seen side on: row 0 is the top, so it
+     * must land in the top rows */
+    bh_scene_default(&scene);
+    scene.num_objects = 1;
+    scene.objects[0].position[0] = 0.0f;
+    scene.objects[0].position[1] = 4e10f;
+    scene.objects[0].position[2] = 0.0f;
+    scene.objects[0].radius = 1.5e10f;
+    scene.objects[0].color[0] = 1.0f;
+    scene.objects[0].color[1] = scene.objects[0].color[2] = 0.0f;
+    CHECK(bh_renderer_set_scene(r, &scene) == BH_OK);
+    memset(&cam, 0, sizeof(cam));
+    cam.position[0] = 1e10f;   /* off the tracer's polar (z) axis */
+    cam.position[2] = 1e11f;
+    cam.fov_y = 60.0f;
+    cam.projection = BH_PROJECTION_PINHOLE;
+    CHECK(bh_render(r, &cam, NULL) == BH_INVALID_ARGUMENT);
+
+    /* two top-down renders over different fills must agree, so every pixel is written */
+    memset(a, 0x00, bytes);
+    memset(b, 0xff, bytes);
+    CHECK(renderInto(r, &cam, a, 0) == BH_OK);
+    CHECK(renderInto(r, &cam, b, 0) == BH_OK);
+    for (y = 0; y < H; ++y)
+        CHECK(memcmp(rowOf(a, y, 0), rowOf(b, y, 0), W * 4) == 0);
+    for (y = 0; y < H; ++y) {
+        int x, red = 0;
+        for (x = 0; x < W; ++x) {
+            const uint8_t* px = rowOf(a, y, 0) + x * 4;
+            red += px[0] > 128 && px[1] < 64 && px[2] < 64;
+        }
+        if (y < H / 2 - 1) top += red;
+        if (y > H / 2) bottom += red;
+    }
+    CHECK(top > 0 && bottom == 0);
+
+    /* bottom-up: row y is STRIDE bytes below row y + 1 but holds the same pixels */
+    memset(c, 0xab, bytes);
+    CHECK(renderInto(r, &cam, c, 1) == BH_OK);
+    for (y = 0; y < H; ++y)
+        CHECK(memcmp(rowOf(c, y, 1), rowOf(a, y, 0), W * 4) == 0);
+    /* nothing outside the rows was touched */
+    for (i = 0; i < bytes; ++i)
+        if (i < STRIDE || i >= STRIDE * (H + 1) || i % STRIDE >= W * 4)
+            untouched += c[i] == 0xab;
+    CHECK(untouched == bytes - (size_t)W * 4 * H);
+
+    bh_renderer_destroy(r);
+    free(a);
+    free(b);
+    free(c);
+    if (failures) fprintf(stderr, "%d check(s) failed\n", failures);
+    else printf("libblackhole C API: all checks passed\n");
+    return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,187 @@
+#include <glm/glm.hpp>
+#include <vector>
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <chrono>
+#include <random>
+#define _USE_MATH_DEFINES
+#include <cmath>
+#include "star_catalog.h"
+using namespace std;
+using Clock = std::chrono::steady_clock;
+
+// Builds the memory-mapped star catalog read by star_catalog.h.
+//   BuildStarCatalog <catalog.csv> <out.stars> [--order k]
+//       catalog lines are "ra dec mag [b-v]" in degrees, separated by commas,
+//       spaces or tabs; lines that don't parse (headers, # comments) are skipped.
+//       Declination is measured from the scene's x-z plane towards +y.
+//   BuildStarCatalog --random N <out.stars> [--seed s] [--order k]
+//       N synthetic stars, uniform over the sky, magnitudes like a real field.
+// The input is read three times (count, bin, scatter) and the output is
+// written through a mapping, so memory use is a few bytes per finest cell no
+// matter how many stars there are.
+
+const int STARS_PER_CELL = 8;   // target mean occupancy of a finest cell
+
+// -- Star sources -- //
+struct StarSource {
+    string path;                 // empty = synthetic
+    uint64_t count = 0;
+    uint64_t seed = 1;
+
+    FILE* f = nullptr;
+    mt19937_64 rng;
+    uint64_t emitted = 0;
+    double magMax = 0.0;
+
+    bool rewind() {
+        emitted = 0;
+        if (path.empty()) {
+            rng.seed(seed);
+            // k-th brightest of N sits at about magMax + 2 log10(k / N); start at -1.5
+            magMax = -1.5 + 2.0 * log10(double(max<uint64_t>(count, 1)));
+            return true;
+        }
+        if (f) fclose(f);
+        f = fopen(path.c_str(), "r");
+        return f != nullptr;
+    }
+    // Next star as a unit direction, magnitude and B-V.
+    bool next(glm::vec3& dir, float& mag, float& bv) {
+        if (path.empty()) {
+            if (emitted == count) return false;
+            ++emitted;
+            uniform_real_distribution<double> u(0.0, 1.0);
+            normal_distribution<double> n(0.6, 0.45);
+            double z = 2.0 * u(rng) - 1.0, phi = 2.0 * M_PI * u(rng);
+            double s = sqrt(max(0.0, 1.0 - z * z));
+            dir = glm::normalize(glm::vec3(float(s * cos(phi)), float(z), float(s * sin(phi))));
+            mag = float(magMax + 2.0 * log10(max(u(rng), 1e-300)));
+            bv = float(n(rng));
+            return true;
+        }
+        char line[1024];
+        while (fgets(line, sizeof(line), f)) {
+            for (char* c = line; *c; ++c)
+                if (*c == ',' || *c == ';' || *c == '\t') *c = ' ';
+            double ra, dec, m, b = 0.6;
+            int got = sscanf(line, "%lf %lf %lf %lf", &ra, &dec, &m, &b);
+            if (got < 3 || !isfinite(ra) || !isfinite(dec) || !isfinite(m)) continue;
+            double lon = ra * M_PI / 180.0, lat = dec * M_PI / 180.0;
+            dir = glm::normalize(glm::vec3(float(cos(lat) * cos(lon)), float(sin(lat)), float(cos(lat) * sin(lon))));
+            mag = float(m);
+            bv = isfinite(b) ? float(b) : 0.6f;
+            ++emitted;
+            return true;
+        }
+        return false;
+    }
+    ~StarSource() { if (f) fclose(f); }
+};
+
+void usage() {
+    cerr << "usage:\n"
+            "  BuildStarCatalog <catalog.csv> <out.stars> [--order k]\n"
+            "  BuildStarCatalog --random N <out.stars> [--seed s] [--order k]\n"
+            "  catalog lines: ra dec mag [b-v] (degrees); order 0.." << HEALPIX_MAX_ORDER
+         << " is the finest HEALPix level, picked from the star count by default\n";
+}
+
+int main(int argc, char** argv) {
+    StarSource src;
+    string out;
+    int order = -1;
+    bool random = false;
+    vector<string> files;
+    for (int i = 1; i < argc; ++i) {
+        string a = argv[i];
+        auto next = [&]() -> const char* {
+            if (i + 1 >= argc) { usage(); exit(EXIT_FAILURE); }
+            return argv[++i];
+        };
+        if (a == "--random") { random = true; src.count = strtoull(next(), nullptr, 10); }
+        else if (a == "--seed") src.seed = strtoull(next(), nullptr, 10);
+        else if (a == "--order") order = atoi(next());
+        else if (a.size() > 1 && a[0] == '-') { usage(); return EXIT_FAILURE; }
+        else files.push_back(a);
+    }
+    if (random ? files.size() != 1 : files.size() != 2) { usage(); return EXIT_FAILURE; }
+    if (!random) src.path = files[0];
+    out = files.back();
+    if (order > HEALPIX_MAX_ORDER) { usage(); return EXIT_FAILURE; }
+    auto t0 = Clock::now();
+
+    // 1) count
+    glm::vec3 dir;
+    float mag, bv;
+    if (!random) {
+        if (!src.rewind()) { cerr << "Failed to open " << src.path << "\n"; return EXIT_FAILURE; }
+        while (src.next(dir, mag, bv)) {}
+        src.count = src.emitted;
+    }
+    if (src.count >= 0xFFFFFFFFull) { cerr << "Too many stars for one catalog file\n"; return EXIT_FAILURE; }
+    if (order < 0) {
+        order = 0;
+        while (order < HEALPIX_MAX_ORDER && double(src.count) > double(healpixCells(order)) * STARS_PER_CELL) ++order;
+    }
+    const int64_t cells = healpixCells(order);
+
+    StarFileHeader head;
+    starFileLayout(head, order, src.count);
+    MappedFile file;
+    if (!file.open(out.c_str(), head.fileSize)) {
+        cerr << "Failed to create " << out << " (" << head.fileSize << " bytes)\n";
+        return EXIT_FAILURE;
+    }
+    memset(file.data, 0, size_t(head.starsOffset));
+    memcpy(file.data, &head, sizeof(head));
+    float* flux = reinterpret_cast<float*>(file.data + head.cellsOffset);
+    uint32_t* index = reinterpret_cast<uint32_t*>(file.data + head.indexOffset);
+    StarRecord* stars = reinterpret_cast<StarRecord*>(file.data + head.starsOffset);
+    float* finest = flux + healpixLevelStart(order) * 3;
+    cout << "[stars] " << src.count << " stars, HEALPix order " << order << " (" << cells << " cells), "
+         << fixed << setprecision(1) << head.fileSize / 1048576.0 << " MB" << defaultfloat << setprecision(6) << "\n";
+
+    // 2) per-cell counts (shifted by one for the prefix sum) and flux
+    if (!src.rewind()) { cerr << "Failed to reopen " << src.path << "\n"; return EXIT_FAILURE; }
+    while (src.next(dir, mag, bv)) {
+        int64_t c = healpixNest(order, dir);
+        glm::vec3 f = starColour(bv) * float(pow(10.0, -0.4 * mag) / 3.0);
+        ++index[c + 1];
+        finest[c * 3 + 0] += f.r;
+        finest[c * 3 + 1] += f.g;
+        finest[c * 3 + 2] += f.b;
+    }
+    if (src.emitted != src.count) { cerr << src.path << " changed while reading it\n"; return EXIT_FAILURE; }
+    for (int64_t c = 0; c < cells; ++c) index[c + 1] += index[c];
+    // coarser orders: each cell is the sum of its four children
+    for (int k = order - 1; k >= 0; --k) {
+        float* parent = flux + healpixLevelStart(k) * 3;
+        const float* child = flux + healpixLevelStart(k + 1) * 3;
+        for (int64_t c = 0; c < healpixCells(k) * 3; ++c) {
+            int64_t cell = c / 3, ch = c % 3;
+            double sum = 0.0;
+            for (int j = 0; j < 4; ++j) sum += child[(cell * 4 + j) * 3 + ch];
+            parent[c] = float(sum);
+        }
+    }
+
+    // 3) scatter the stars into their cells
+    vector<uint32_t> cursor(index, index + cells);
+    if (!src.rewind()) { cerr << "Failed to reopen " << src.path << "\n"; return EXIT_FAILURE; }
+    while (src.next(dir, mag, bv)) {
+        int64_t c = healpixNest(order, dir);
+        if (cursor[c] == index[c + 1]) { cerr << src.path << " changed while reading it\n"; return EXIT_FAILURE; }
+        glm::vec3 f = starColour(bv) * float(pow(10.0, -0.4 * mag) / 3.0);
+        stars[cursor[c]++] = { dir.x, dir.y, dir.z, f.r, f.g, f.b };
+    }
+    file.close();
+
+    double sec = chrono::duration<double>(Clock::now() - t0).count();
+    cout << "[stars] Wrote " << out << " in " << sec << " s\n";
+    return 0;
+}
@@ -0,0 +1,301 @@
+#pragma once
+// Session recording for BlackHole3D. Frames are read back from the window
+// through a ring of pixel pack buffers: glReadPixels into a PBO only queues
+// the copy, and the buffer is mapped a few frames later once its fence has
+// signalled, so the render loop never waits on the GPU for a capture. Mapped
+// frames go to an encoder thread that converts and writes them; if it falls
+// behind, frames are dropped (and counted) rather than slowing the loop.
+#include <GL/glew.h>
+#include "image_writer.h"
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+struct CapturedFrame {
+    int width = 0, height = 0;
+    bool bottomUp = false;         // GL and the CPU tracer both count rows from the bottom
+    std::vector<uint8_t> rgba;
+
+    const uint8_t* row(int y) const {   // y = 0 is the top row
+        int r = bottomUp ? height - 1 - y : y;
+        return rgba.data() + size_t(r) * width * 4;
+    }
+};
+
+// -- Encoder -- //
+// The output format follows the path:
+//   .y4m       one YUV4MPEG2 stream, 4:2:0 full-range BT.601 (C420jpeg), which
+//              ffmpeg and most players read directly
+//   .png/.ppm  an image sequence; a %d, %Nd or %0Nd in the path (shot_%05d.png)
+//              is the zero-padded frame number, otherwise _00000, _00001, ... goes
+//              before the extension. Any other % in the path fails open().
+//   other      raw RGB24, top row first (ffmpeg -f rawvideo -pix_fmt rgb24)
+// Streams keep the size of their first frame; frames of another size are
+// skipped and counted as failed.
+struct FrameEncoder {
+    enum Format { Y4M, Sequence, Raw };
+    static const size_t MAX_QUEUED = 8;   // frames waiting to be written before new ones drop
+
+    std::string path;
+    Format format = Raw;
+    std::string prefix, suffix;           // Sequence: file name around the frame number
+    int digits = 0;                       // Sequence: frame number zero-padded to this
+    int fps = 60;
+    FILE* stream = nullptr;
+    int streamW = 0, streamH = 0;
+    std::vector<uint8_t> planes;          // Y4M frame / raw RGB row, reused
+    std::thread worker;
+    std::mutex lock;
+    std::condition_variable wake;
+    std::deque<CapturedFrame> queue;
+    std::vector<CapturedFrame> spare;     // written frames, their pixels reused
+    bool closing = false;
+    std::atomic<uint64_t> written{ 0 }, dropped{ 0 }, failed{ 0 };
+
+    static bool endsWith(const std::string& s, const char* ext) {
+        size_t n = std::strlen(ext);
+        return s.size() >= n && s.compare(s.size() - n, n, ext) == 0;
+    }
+    bool open(const std::string& p, int framesPerSecond) {
+        path = p;
+        fps = framesPerSecond > 0 ? framesPerSecond : 60;
+        if (endsWith(path, ".y4m")) format = Y4M;
+        else if (endsWith(path, ".png") || endsWith(path, ".ppm")) format = Sequence;
+        else format = Raw;
+        if (format == Sequence && !splitPattern()) return false;
+        if (format != Sequence) {
+            stream = std::fopen(path.c_str(), "wb");
+            if (!stream) return false;
+        }
+        worker = std::thread([this]() { run(); });
+        return true;
+    }
+    bool isOpen() const { return worker.joinable(); }
+    // shot_%05d.png -> "shot_", 5, ".png"; the path is never handed to printf
+    bool splitPattern() {
+        size_t pct = path.find('%');
+        if (pct == std::string::npos) {
+            size_t dot = path.rfind('.');
+            prefix = path.substr(0, dot) + "_";
+            suffix = path.substr(dot);
+            digits = 5;
+            path = prefix + "%05d" + suffix;
+            return true;
+        }
+        size_t i = pct + 1;
+        if (i < path.size() && path[i] == '0') ++i;
+        size_t width = i;
+        while (i < path.size() && path[i] >= '0' && path[i] <= '9') ++i;
+        if (i == path.size() || path[i] != 'd' || i - width > 2 || path.find('%', i) != std::string::npos)
+            return false;
+        digits = i > width ? std::atoi(path.substr(width, i - width).c_str()) : 0;
+        prefix = path.substr(0, pct);
+        suffix = path.substr(i + 1);
+        return true;
+    }
+
+    // an empty frame of this size to fill, reusing the pixels of a written one
+    CapturedFrame take(int w, int h) {
+        CapturedFrame f;
+        {
+            std::lock_guard<std::mutex> g(lock);
+            if (!spare.empty()) {
+                f = std::move(spare.back());
+                spare.pop_back();
+            }
+        }
+        f.width = w;
+        f.height = h;
+        f.rgba.resize(size_t(w) * h * 4);
+        return f;
+    }
+    // queues f, or drops it when the writer is MAX_QUEUED frames behind
+    void submit(CapturedFrame&& f) {
+        std::lock_guard<std::mutex> g(lock);
+        if (queue.size() >= MAX_QUEUED) {
+            ++dropped;
+            spare.push_back(std::move(f));
+            return;
+        }
+        queue.push_back(std::move(f));
+        wake.notify_one();
+    }
+    // writes what is queued, then closes the output
+    void finish() {
+        if (!isOpen()) return;
+        {
+            std::lock_guard<std::mutex> g(lock);
+            closing = true;
+        }
+        wake.notify_one();
+        worker.join();
+        if (stream) std::fclose(stream);
+        stream = nullptr;
+    }
+    ~FrameEncoder() { finish(); }
+
+    void run() {
+        for (;;) {
+            CapturedFrame f;
+            {
+                std::unique_lock<std::mutex> g(lock);
+                wake.wait(g, [this]() { return closing || !queue.empty(); });
+                if (queue.empty()) return;
+                f = std::move(queue.front());
+                queue.pop_front();
+            }
+            if (write(f)) ++written;
+            else ++failed;
+            std::lock_guard<std::mutex> g(lock);
+            spare.push_back(std::move(f));
+        }
+    }
+    bool write(const CapturedFrame& f) {
+        if (format == Sequence) {
+            std::string number = std::to_string(written + failed);
+            if (int(number.size()) < digits) number.insert(0, size_t(digits) - number.size(), '0');
+            std::unique_ptr<ImageStreamWriter> out(openImageStream(prefix + number + suffix, f.width, f.height));
+            if (!out) return false;
+            bool ok = true;
+            for (int y = 0; y < f.height && ok; ++y) ok = out->writeRow(f.row(y));
+            return out->finish() && ok;
+        }
+        if (streamW == 0) {
+            streamW = f.width;
+            streamH = f.height;
+            if (format == Y4M)
+                std::fprintf(stream, "YUV4MPEG2 W%d H%d F%d:1 Ip A1:1 C420jpeg\n", streamW, streamH, fps);
+        }
+        if (f.width != streamW || f.height != streamH) return false;
+        return format == Y4M ? writeY4M(f) : writeRaw(f);
+    }
+    bool writeRaw(const CapturedFrame& f) {
+        planes.resize(size_t(f.width) * 3);
+        for (int y = 0; y < f.height; ++y) {
+            const uint8_t* src = f.row(y);
+            for (int x = 0; x < f.width; ++x) std::memcpy(&planes[x * 3], src + x * 4, 3);
+            if (std::fwrite(planes.data(), 1, planes.size(), stream) != planes.size()) return false;
+        }
+        return true;
+    }
+    // JFIF YCbCr in 16.16 fixed point, chroma averaged over 2x2 blocks
+    bool writeY4M(const CapturedFrame& f) {
+        const int w = f.width, h = f.height, cw = (w + 1) / 2, ch = (h + 1) / 2;
+        planes.resize(size_t(w) * h + 2 * size_t(cw) * ch);
+        uint8_t* Y = planes.data();
+        uint8_t* U = Y + size_t(w) * h;
+        uint8_t* V = U + size_t(cw) * ch;
+        for (int y = 0; y < h; ++y) {
+            const uint8_t* src = f.row(y);
+            for (int x = 0; x < w; ++x) {
+                const uint8_t* p = src + x * 4;
+                Y[size_t(y) * w + x] = uint8_t((19595 * p[0] + 38470 * p[1] + 7471 * p[2] + 32768) >> 16);
+            }
+        }
+        for (int y = 0; y < ch; ++y)
+            for (int x = 0; x < cw; ++x) {
+                int r = 0, g = 0, b = 0, n = 0;
+                for (int dy = 0; dy < 2 && 2 * y + dy < h; ++dy)
+                    for (int dx = 0; dx < 2 && 2 * x + dx < w; ++dx, ++n) {
+                        const uint8_t* p = f.row(2 * y + dy) + (2 * x + dx) * 4;
+                        r += p[0]; g += p[1]; b += p[2];
+                    }
+                r /= n; g /= n; b /= n;
+                // pure blue / red round up to 256
+                U[size_t(y) * cw + x] = uint8_t(std::min((-11059 * r - 21709 * g + 32768 * b + (128 << 16) + 32768) >> 16, 255));
+                V[size_t(y) * cw + x] = uint8_t(std::min((32768 * r - 27439 * g - 5329 * b + (128 << 16) + 32768) >> 16, 255));
+            }
+        return std::fputs("FRAME\n", stream) >= 0 &&
+               std::fwrite(planes.data(), 1, planes.size(), stream) == planes.size();
+    }
+};
+
+// -- Readback -- //
+// CAPTURE_RING is deeper than BlackHole3D's frame pipeline can get, so by the
+// time a slot comes round again its copy has long finished; if it somehow
+// hasn't, that one grab waits and is counted as a stall.
+const int CAPTURE_RING = 5;
+
+struct FrameCapture {
+    FrameEncoder encoder;
+    GLuint pbo[CAPTURE_RING] = {};
+    GLsync fence[CAPTURE_RING] = {};
+    int size[CAPTURE_RING][2] = {};
+    GLsizeiptr capacity[CAPTURE_RING] = {};
+    int next = 0;                  // slot of the next grab, also the oldest pending one
+    uint64_t stalls = 0;
+
+    bool open(const std::string& path, int fps) {
+        if (!encoder.open(path, fps)) return false;
+        glGenBuffers(CAPTURE_RING, pbo);
+        return true;
+    }
+    bool active() const { return encoder.isOpen(); }
+    // queues a copy of the current read framebuffer (the window's back buffer)
+    void grab(int w, int h) {
+        if (!active()) return;
+        collect(false);
+        const int i = next;
+        next = (next + 1) % CAPTURE_RING;
+        if (fence[i]) {
+            harvest(i, true);
+            ++stalls;
+        }
+        glBindFramebuffer(GL_READ_FRAMEBUFFER, 0);
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, pbo[i]);
+        const GLsizeiptr bytes = GLsizeiptr(w) * h * 4;
+        if (capacity[i] != bytes) {
+            glBufferData(GL_PIXEL_PACK_BUFFER, bytes, nullptr, GL_STREAM_READ);
+            capacity[i] = bytes;
+        }
+        glPixelStorei(GL_PACK_ALIGNMENT, 4);
+        glReadPixels(0, 0, w, h, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+        fence[i] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        size[i][0] = w;
+        size[i][1] = h;
+    }
+    // hands finished copies to the encoder oldest first; wait = block for all
+    void collect(bool wait) {
+        for (int k = 0; k < CAPTURE_RING; ++k) {
+            int i = (next + k) % CAPTURE_RING;
+            if (fence[i] && !harvest(i, wait)) return;
+        }
+    }
+    bool harvest(int i, bool wait) {
+        GLenum r = glClientWaitSync(fence[i], wait ? GL_SYNC_FLUSH_COMMANDS_BIT : 0, wait ? ~GLuint64(0) : 0);
+        if (r == GL_TIMEOUT_EXPIRED) return false;
+        glDeleteSync(fence[i]);
+        fence[i] = 0;
+        CapturedFrame f = encoder.take(size[i][0], size[i][1]);
+        f.bottomUp = true;
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, pbo[i]);
+        if (const void* p = glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, GLsizeiptr(f.rgba.size()), GL_MAP_READ_BIT)) {
+            std::memcpy(f.rgba.data(), p, f.rgba.size());
+            glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+            encoder.submit(std::move(f));
+        }
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+        return true;
+    }
+    // writes every pending frame and closes the output
+    void finish() {
+        if (!active()) return;
+        if (pbo[0]) {
+            collect(true);
+            glDeleteBuffers(CAPTURE_RING, pbo);
+            pbo[0] = 0;
+        }
+        encoder.finish();
+    }
+};
@@ -0,0 +1,832 @@
+#pragma once
+// CPU port of geodesic.comp.
+// The uniform blocks are mirrored byte for byte so the GPU and CPU paths are
+// fed from the same structs, and the per-pixel loop is the shader's main()
+// run over packets of LANES pixels on a small thread pool.
+#include <glm/glm.hpp>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <atomic>
+#include <chrono>
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstddef>
+#include <cstdio>
+#include "star_catalog.h"
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+// -- std140 mirrors of the geodesic.comp uniform blocks -- //
+struct CameraUBO {                 // binding = 1
+    glm::vec3 pos;     float _pad0;
+    glm::vec3 right;   float _pad1;
+    glm::vec3 up;      float _pad2;
+    glm::vec3 forward; float _pad3;
+    float tanHalfFov;
+    float aspect;
+    int   moving;                  // std140 bool is 4 bytes
+    int   _pad4;
+};
+struct DiskUBO {                   // binding = 2
+    float r1;
+    float r2;
+    float num;
+    float thickness;
+};
+const int MAX_OBJECTS = 16;
+struct ObjectsUBO {                // binding = 3
+    int   numObjects;
+    float _pad0, _pad1, _pad2;
+    glm::vec4 posRadius[MAX_OBJECTS];
+    glm::vec4 color[MAX_OBJECTS];
+    glm::vec4 mass[MAX_OBJECTS];   // std140 float[] has a 16 byte stride, mass in .x
+};
+static_assert(sizeof(CameraUBO) == 80, "CameraUBO must match the std140 Camera block");
+static_assert(sizeof(DiskUBO) == 16, "DiskUBO must match the std140 Disk block");
+static_assert(sizeof(ObjectsUBO) == 16 + 3 * MAX_OBJECTS * 16, "ObjectsUBO must match the std140 Objects block");
+
+// -- Thread pool -- //
+// What the tracer needs from a pool: fn(i) for every i in [0, count), on any
+// threads, returning once all calls are done. Embedders can plug their own in.
+struct TaskRunner {
+    virtual ~TaskRunner() {}
+    virtual unsigned size() const = 0;
+    virtual void parallelFor(int count, const std::function<void(int)>& fn) = 0;
+};
+
+// Persistent workers that share one parallelFor at a time; the calling thread
+// works too, so a pool of size 1 runs everything inline.
+struct ThreadPool : TaskRunner {
+    explicit ThreadPool(unsigned threads = std::thread::hardware_concurrency()) {
+        if (threads == 0) threads = 1;
+        for (unsigned i = 1; i < threads; ++i)
+            workers.emplace_back([this] { run(); });
+    }
+    ~ThreadPool() {
+        {
+            std::lock_guard<std::mutex> lk(m);
+            quit = true;
+        }
+        cv.notify_all();
+        for (auto& t : workers) t.join();
+    }
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    unsigned size() const override { return unsigned(workers.size()) + 1; }
+
+    // Calls fn(i) for i in [0, count), handing out indices dynamically.
+    void parallelFor(int count, const std::function<void(int)>& fn) override {
+        std::lock_guard<std::mutex> serial(dispatchMutex);
+        {
+            std::lock_guard<std::mutex> lk(m);
+            job = &fn;
+            jobCount = count;
+            next = 0;
+            busy = int(workers.size());
+            ++generation;
+        }
+        cv.notify_all();
+        drain();
+        std::unique_lock<std::mutex> lk(m);
+        doneCv.wait(lk, [this] { return busy == 0; });
+        job = nullptr;
+    }
+
+private:
+    std::vector<std::thread> workers;
+    std::mutex m, dispatchMutex;
+    std::condition_variable cv, doneCv;
+    const std::function<void(int)>* job = nullptr;
+    int jobCount = 0;
+    std::atomic<int> next{0};
+    int busy = 0;
+    uint64_t generation = 0;
+    bool quit = false;
+
+    void drain() {
+        for (int i = next.fetch_add(1); i < jobCount; i = next.fetch_add(1))
+            (*job)(i);
+    }
+    void run() {
+        uint64_t seen = 0;
+        std::unique_lock<std::mutex> lk(m);
+        for (;;) {
+            cv.wait(lk, [&] { return quit || generation != seen; });
+            if (quit) return;
+            seen = generation;
+            lk.unlock();
+            drain();
+            lk.lock();
+            if (--busy == 0) doneCv.notify_one();
+        }
+    }
+};
+
+// -- CPU framebuffer -- //
+// RGBA8 in image2D order: row 0 is gl_GlobalInvocationID.y == 0. A buffer can
+// hold just a region of the image, with its top-left pixel at (originX, originY).
+// wrap() points it at caller-owned rows instead, any stride, negative included.
+struct CpuFramebuffer {
+    int width = 0, height = 0;
+    int originX = 0, originY = 0;
+    std::vector<uint8_t> rgba;
+    uint8_t* external = nullptr;
+    std::ptrdiff_t externalStride = 0; // bytes from row y to row y + 1
+
+    void resize(int w, int h, int x0 = 0, int y0 = 0) {
+        width = w; height = h;
+        originX = x0; originY = y0;
+        external = nullptr;
+        rgba.assign(size_t(w) * h * 4, 0);
+    }
+    void wrap(uint8_t* rows, int w, int h, std::ptrdiff_t stride, int x0 = 0, int y0 = 0) {
+        width = w; height = h;
+        originX = x0; originY = y0;
+        external = rows;
+        externalStride = stride;
+        rgba.clear();
+    }
+    uint8_t* row(int y) {
+        if (external) return external + std::ptrdiff_t(y - originY) * externalStride;
+        return &rgba[size_t(y - originY) * width * 4];
+    }
+    void store(int x, int y, glm::vec4 c) {
+        uint8_t* p = row(y) + size_t(x - originX) * 4;
+        for (int i = 0; i < 4; ++i)
+            p[i] = uint8_t(std::lround(glm::clamp(c[i], 0.0f, 1.0f) * 255.0f));
+    }
+};
+
+// Writes an RGBA8 image as binary PPM, flipped so the top row on screen comes first.
+inline bool writePPM(const char* path, int w, int h, const uint8_t* rgba) {
+    FILE* f = std::fopen(path, "wb");
+    if (!f) return false;
+    std::fprintf(f, "P6\n%d %d\n255\n", w, h);
+    std::vector<uint8_t> row(size_t(w) * 3);
+    for (int y = h - 1; y >= 0; --y) {
+        const uint8_t* src = rgba + size_t(y) * w * 4;
+        for (int x = 0; x < w; ++x) {
+            row[x*3+0] = src[x*4+0];
+            row[x*3+1] = src[x*4+1];
+            row[x*3+2] = src[x*4+2];
+        }
+        std::fwrite(row.data(), 1, row.size(), f);
+    }
+    return std::fclose(f) == 0;
+}
+
+namespace cpu {
+
+const float  SagA_rs   = 1.269e10f;
+const float  D_LAMBDA  = 1e7f;
+const double ESCAPE_R  = 1e30;
+const int    MAX_STEPS = 60000;
+const int    LANES     = 8;     // pixels advanced together per packet
+const int    TILE      = 16;    // tile edge, and the height of a hybrid-mode band
+
+// -- Camera models -- //
+// PROJ_EQUIRECT: longitude across x (pixel centres), latitude across y with the
+// first and last rows exactly on the poles. PROJ_CUBE_FACE: one face of a cube
+// map sampled edge to edge, so neighbouring faces share their border rays
+// exactly (see cubeLattice). Both are relative to the camera's basis.
+enum Projection { PROJ_PINHOLE = 0, PROJ_EQUIRECT = 1, PROJ_CUBE_FACE = 2 };
+enum CubeFace { FACE_FRONT = 0, FACE_RIGHT, FACE_BACK, FACE_LEFT, FACE_UP, FACE_DOWN };
+
+struct TraceParams {
+    CameraUBO  cam;
+    DiskUBO    disk;
+    ObjectsUBO objects;
+    float rs = SagA_rs;            // horizon radius; the step length scales with it
+    float spin = 0.0f;             // a = J/M about +y, |a| < 1; 0 = Schwarzschild path
+    int projection = PROJ_PINHOLE;
+    int face = FACE_FRONT;         // PROJ_CUBE_FACE only
+    const StarCatalog* stars = nullptr; // background for escaped rays, null = black
+    float starExposure = 100.0f;   // display scale for star flux (1 = magnitude 0)
+    int starOrder = -1;            // >= 0: mip levels 0..starOrder only, see StarCatalog::flux
+};
+
+enum HitType { HIT_NONE = 0, HIT_BLACK_HOLE, HIT_DISK, HIT_OBJECT };
+
+struct Ray {
+    float x, y, z, r, theta, phi;
+    float dr, dtheta, dphi;
+    float E, L;
+};
+inline Ray initRay(glm::vec3 pos, glm::vec3 dir, float rs = SagA_rs) {
+    Ray ray;
+    ray.x = pos.x; ray.y = pos.y; ray.z = pos.z;
+    ray.r = glm::length(pos);
+    ray.theta = std::acos(pos.z / ray.r);
+    ray.phi = std::atan2(pos.y, pos.x);
+
+    float dx = dir.x, dy = dir.y, dz = dir.z;
+    float st = std::sin(ray.theta), ct = std::cos(ray.theta);
+    float sp = std::sin(ray.phi),   cp = std::cos(ray.phi);
+    ray.dr     = st*cp*dx + st*sp*dy + ct*dz;
+    ray.dtheta = (ct*cp*dx + ct*sp*dy - st*dz) / ray.r;
+    ray.dphi   = (-sp*dx + cp*dy) / (ray.r * st);
+
+    ray.L = ray.r * ray.r * st * ray.dphi;
+    // null condition: E = f dt/dlambda = sqrt(dr^2 + f r^2 |dOmega|^2)
+    float f = 1.0f - rs / ray.r;
+    ray.E = std::sqrt(ray.dr*ray.dr + f * ray.r*ray.r*(ray.dtheta*ray.dtheta + st*st*ray.dphi*ray.dphi));
+    return ray;
+}
+
+// Cube map faces sampled on an integer lattice in camera space (right, up,
+// forward), each coordinate in [-M, M] in steps of 2 with M = N - 1. A border
+// pixel of one face has the same lattice point, and so bit-identical ray, as
+// the matching pixel of its neighbour.
+inline glm::ivec3 cubeLattice(int face, int i, int j, int N) {
+    const int M = N - 1, s = 2 * i - M, t = 2 * j - M;
+    switch (face) {
+        case FACE_FRONT: return glm::ivec3( s,  t,  M);
+        case FACE_RIGHT: return glm::ivec3( M,  t, -s);
+        case FACE_BACK:  return glm::ivec3(-s,  t, -M);
+        case FACE_LEFT:  return glm::ivec3(-M,  t,  s);
+        case FACE_UP:    return glm::ivec3( s,  M, -t);
+        default:         return glm::ivec3( s, -M,  t);
+    }
+}
+// Pixel of `face` that samples lattice point L (L must lie on that face).
+inline glm::ivec2 cubePixel(int face, glm::ivec3 L, int N) {
+    const int M = N - 1;
+    int s, t;
+    switch (face) {
+        case FACE_FRONT: s =  L.x; t =  L.y; break;
+        case FACE_RIGHT: s = -L.z; t =  L.y; break;
+        case FACE_BACK:  s = -L.x; t =  L.y; break;
+        case FACE_LEFT:  s =  L.z; t =  L.y; break;
+        case FACE_UP:    s =  L.x; t = -L.z; break;
+        default:         s =  L.x; t =  L.z; break;
+    }
+    return glm::ivec2((s + M) / 2, (t + M) / 2);
+}
+// Lowest-numbered face containing L: the one that traces a shared border ray.
+inline int cubeOwner(glm::ivec3 L, int N) {
+    const int M = N - 1;
+    int owner = 6;
+    if (L.z ==  M) owner = std::min(owner, int(FACE_FRONT));
+    if (L.x ==  M) owner = std::min(owner, int(FACE_RIGHT));
+    if (L.z == -M) owner = std::min(owner, int(FACE_BACK));
+    if (L.x == -M) owner = std::min(owner, int(FACE_LEFT));
+    if (L.y ==  M) owner = std::min(owner, int(FACE_UP));
+    if (L.y == -M) owner = std::min(owner, int(FACE_DOWN));
+    return owner;
+}
+
+// Primary ray for pixel (px, py) of a W x H image, same as geodesic.comp main().
+inline glm::vec3 primaryDirection(const TraceParams& p, int px, int py, int W, int H) {
+    const CameraUBO& cam = p.cam;
+    if (p.projection == PROJ_EQUIRECT) {
+        float lon = (2.0f * (px + 0.5f) / W - 1.0f) * float(M_PI);
+        float lat = (float(py) / float(std::max(H - 1, 1)) - 0.5f) * float(M_PI);
+        return glm::normalize(std::cos(lat) * (std::sin(lon) * cam.right + std::cos(lon) * cam.forward)
+                              + std::sin(lat) * cam.up);
+    }
+    if (p.projection == PROJ_CUBE_FACE) {
+        glm::ivec3 L = cubeLattice(p.face, px, py, W);
+        return glm::normalize(float(L.x) * cam.right + float(L.y) * cam.up + float(L.z) * cam.forward);
+    }
+    float u = (2.0f * (px + 0.5f) / W - 1.0f) * cam.aspect * cam.tanHalfFov;
+    float v = (1.0f - 2.0f * (py + 0.5f) / H) * cam.tanHalfFov;
+    return glm::normalize(u * cam.right - v * cam.up + cam.forward);
+}
+
+// Solid angle of a pixel at the image centre; star lookups filter over it.
+// Lensing magnification is not tracked, so this is the unlensed footprint.
+inline float pixelFootprint(const TraceParams& p, int W, int H) {
+    if (p.projection == PROJ_EQUIRECT) return float(2.0 * M_PI / W * M_PI / std::max(H - 1, 1));
+    float s = p.projection == PROJ_CUBE_FACE ? 2.0f / std::max(W - 1, 1) : 2.0f * p.cam.tanHalfFov / H;
+    return s * s;
+}
+
+// Sky behind an escaped ray leaving along dir.
+inline glm::vec4 background(const TraceParams& p, glm::vec3 dir, float footprint) {
+    if (!p.stars) return glm::vec4(0.0f);
+    glm::vec3 f = p.stars->flux(glm::normalize(dir), footprint, p.starOrder);
+    return glm::vec4(starDisplay(f, p.starExposure), 1.0f);
+}
+
+inline glm::vec4 shade(const TraceParams& p, int hit, int obj, glm::vec3 P) {
+    if (hit == HIT_DISK) {
+        float r = glm::length(P) / p.disk.r2;
+        return glm::vec4(1.0f, r, 0.2f, r);
+    }
+    if (hit == HIT_BLACK_HOLE) return glm::vec4(0.0f, 0.0f, 0.0f, 1.0f);
+    if (hit == HIT_OBJECT) {
+        glm::vec4 base = p.objects.color[obj];
+        glm::vec3 N = glm::normalize(P - glm::vec3(p.objects.posRadius[obj]));
+        glm::vec3 V = glm::normalize(p.cam.pos - P);
+        float ambient = 0.1f;
+        float diff = std::max(glm::dot(N, V), 0.0f);
+        float intensity = ambient + (1.0f - ambient) * diff;
+        return glm::vec4(glm::vec3(base) * intensity, base.a);
+    }
+    return glm::vec4(0.0f);
+}
+
+// -- Volumetric disk -- //
+// With disk.thickness = h > 0 the disk is gas between r1 and r2 with density
+// exp(-y^2 / 2h^2) that emits and absorbs, instead of the thin y = 0 plane. It
+// is ray-marched along the chord of each integration step. The chord is first
+// clipped analytically to the slab |y| < DISK_CUTOFF h and the annulus, so a
+// step nowhere near the disk costs a couple of compares. Inside, the sample
+// spacing follows how fast the density, optical depth and colour change.
+// DISK_TAU is the optical depth straight through the midplane. The source
+// colour is the thin disk's, so an opaque patch matches the thin disk there.
+const float DISK_TAU    = 6.0f;
+const float DISK_CUTOFF = 3.0f;          // slab half-height in h; density there is ~1%
+const float DISK_SAMPLE = 0.5f;          // max change of ln(density), tau or colour per sample
+const float DISK_T_MIN  = 1.0f / 255.0f; // transmittance below which a ray stops
+
+// Marches the chord a -> b through the disk, compositing front to back into
+// glow with transmittance T.
+inline void marchDisk(const DiskUBO& d, glm::vec3 a, glm::vec3 b, glm::vec3& glow, float& T) {
+    const float h = d.thickness, Y = DISK_CUTOFF * h;
+    if ((a.y > Y && b.y > Y) || (a.y < -Y && b.y < -Y)) return;
+    glm::vec3 v = b - a;
+    float len = glm::length(v);
+    if (!(len > 0.0f)) return;
+
+    // chord parameter t in [0, 1]: slab, then inside the outer cylinder
+    float t0 = 0.0f, t1 = 1.0f;
+    if (v.y != 0.0f) {
+        float ta = (-Y - a.y) / v.y, tb = (Y - a.y) / v.y;
+        t0 = std::max(t0, std::min(ta, tb));
+        t1 = std::min(t1, std::max(ta, tb));
+    }
+    float A = v.x*v.x + v.z*v.z, B = a.x*v.x + a.z*v.z, R0 = a.x*a.x + a.z*a.z;
+    float hole0 = 2.0f, hole1 = 2.0f;    // part inside r1, past the chord unless set
+    if (A > 0.0f) {
+        float disc = B*B - A * (R0 - d.r2*d.r2);
+        if (disc <= 0.0f) return;
+        float s = std::sqrt(disc);
+        t0 = std::max(t0, (-B - s) / A);
+        t1 = std::min(t1, (-B + s) / A);
+        disc = B*B - A * (R0 - d.r1*d.r1);
+        if (disc > 0.0f) {
+            s = std::sqrt(disc);
+            hole0 = (-B - s) / A;
+            hole1 = (-B + s) / A;
+        }
+    } else if (R0 > d.r2*d.r2 || R0 < d.r1*d.r1) {
+        return;
+    }
+    if (t0 >= t1) return;
+
+    glm::vec3 u = v / len;
+    const float kappa = DISK_TAU / (h * std::sqrt(2.0f * float(M_PI)));
+    const float uy = std::fabs(u.y), colourRate = std::sqrt(u.x*u.x + u.z*u.z) / d.r2;
+    const float spans[2][2] = { { t0, std::min(t1, hole0) }, { std::max(t0, hole1), t1 } };
+    for (const auto& span : spans) {
+        float s = span[0] * len, end = span[1] * len;
+        while (s < end) {
+            float y = a.y + u.y * s;
+            float rho = std::exp(-0.5f * y*y / (h*h));
+            // d ln(rho)/ds = u_y y / h^2; the extra u_y / h keeps midplane crossings sampled
+            float rate = uy * (1.0f + std::fabs(y) / h) / h + kappa * rho + colourRate;
+            float ds = std::min(DISK_SAMPLE / rate, end - s);
+            glm::vec3 m = a + u * (s + 0.5f * ds);
+            float absorb = 1.0f - std::exp(-kappa * std::exp(-0.5f * m.y*m.y / (h*h)) * ds);
+            float R = std::sqrt(m.x*m.x + m.z*m.z);
+            glow += T * absorb * glm::vec3(1.0f, R / d.r2, 0.2f);
+            T *= 1.0f - absorb;
+            if (T < DISK_T_MIN) return;
+            s += ds;
+        }
+    }
+}
+
+// What the camera sees through gas of transmittance T and emission glow in
+// front of `behind`.
+inline glm::vec4 composite(glm::vec3 glow, float T, glm::vec4 behind) {
+    return glm::vec4(glow + T * glm::vec3(behind), 1.0f - T + T * behind.a);
+}
+
+// -- Packet tracer -- //
+// Each lane runs the shader's step loop for one pixel; when a lane terminates
+// its result is written and the next pixel of the tile is loaded into it, so
+// long photon-ring rays don't leave the other lanes idle.
+struct RayPacket {
+    float r[LANES], theta[LANES], phi[LANES];
+    float dr[LANES], dtheta[LANES], dphi[LANES];
+    float E[LANES];
+    float x[LANES], y[LANES], z[LANES];
+    float px[LANES], py[LANES], pz[LANES];   // previous position
+    int   steps[LANES];
+    int   pixel[LANES];                      // -1 = lane idle
+    float rs = SagA_rs, dL = D_LAMBDA;
+
+    void setup(const TraceParams& p);
+    void load(int l, const TraceParams& p, int pix, int px, int py, int W, int H);
+    void park(int l);
+    void step();
+    bool insideHorizon(int l) const { return r[l] <= rs; }
+    bool escaped(int l) const { return r[l] > ESCAPE_R; }
+};
+
+inline void loadLane(RayPacket& pk, int l, const TraceParams& p, int pixel, int x, int y, int W, int H) {
+    Ray ray = initRay(p.cam.pos, primaryDirection(p, x, y, W, H), p.rs);
+    pk.r[l] = ray.r; pk.theta[l] = ray.theta; pk.phi[l] = ray.phi;
+    pk.dr[l] = ray.dr; pk.dtheta[l] = ray.dtheta; pk.dphi[l] = ray.dphi;
+    pk.E[l] = ray.E;
+    pk.x[l] = pk.px[l] = ray.x;
+    pk.y[l] = pk.py[l] = ray.y;
+    pk.z[l] = pk.pz[l] = ray.z;
+    pk.steps[l] = 0;
+    pk.pixel[l] = pixel;
+}
+
+// One Euler step of every lane (geodesic.comp's rk4Step), written so the
+// compiler can vectorize across lanes.
+inline void stepPacket(RayPacket& pk, float dL, float rs) {
+    #pragma omp simd
+    for (int l = 0; l < LANES; ++l) {
+        float r = pk.r[l], theta = pk.theta[l];
+        float dr = pk.dr[l], dtheta = pk.dtheta[l], dphi = pk.dphi[l];
+        float st = std::sin(theta), ct = std::cos(theta);
+        float f = 1.0f - rs / r;
+        float dt_dL = pk.E[l] / f;
+
+        float d2r = -(rs / (2.0f * r*r)) * f * dt_dL * dt_dL
+                  + (rs / (2.0f * r*r * f)) * dr * dr
+                  + r * f * (dtheta*dtheta + st*st*dphi*dphi);
+        float d2t = -2.0f*dr*dtheta/r + st*ct*dphi*dphi;
+        float d2p = -2.0f*dr*dphi/r - 2.0f*ct/st * dtheta * dphi;
+
+        pk.px[l] = pk.x[l]; pk.py[l] = pk.y[l]; pk.pz[l] = pk.z[l];
+        r     += dL * dr;
+        theta += dL * dtheta;
+        float phi = pk.phi[l] + dL * dphi;
+        pk.r[l] = r; pk.theta[l] = theta; pk.phi[l] = phi;
+        pk.dr[l]     = dr     + dL * d2r;
+        pk.dtheta[l] = dtheta + dL * d2t;
+        pk.dphi[l]   = dphi   + dL * d2p;
+
+        float sn = std::sin(theta);
+        pk.x[l] = r * sn * std::cos(phi);
+        pk.y[l] = r * sn * std::sin(phi);
+        pk.z[l] = r * std::cos(theta);
+    }
+}
+
+inline void RayPacket::setup(const TraceParams& p) {
+    rs = p.rs;
+    dL = D_LAMBDA * (p.rs / SagA_rs);
+}
+inline void RayPacket::load(int l, const TraceParams& p, int pix, int px_, int py_, int W, int H) {
+    loadLane(*this, l, p, pix, px_, py_, W, H);
+}
+inline void RayPacket::park(int l) {
+    pixel[l] = -1;
+    r[l] = 2.0f * rs; theta[l] = 1.0f; phi[l] = 0.0f;
+    dr[l] = dtheta[l] = dphi[l] = 0.0f; E[l] = 1.0f;
+    x[l] = y[l] = z[l] = 0.0f;
+    steps[l] = 0;
+}
+inline void RayPacket::step() { stepPacket(*this, dL, rs); }
+
+// -- Kerr -- //
+// Hole of spin a = J/M about the scene's +y axis, in Boyer-Lindquist
+// coordinates with BL axes (X, Y, Z) = scene (z, x, y), so the disk plane is
+// the equator. Photons (E = 1) follow Carter's separated equations in Mino
+// time tau (d lambda = Sigma d tau), taken to second order so turning points
+// need no sign bookkeeping:
+//   r''     = R'(r) / 2          R = P^2 - Delta K
+//   theta'' = Theta'(theta) / 2  Theta = Q + a^2 cos^2 - L^2 cot^2
+//   phi'    = a P / Delta - a + L / sin^2
+// with P = r^2 + a^2 - a L, K = (L - a)^2 + Q, Delta = r^2 - 2r + a^2.
+// Lengths are in units of M = rs / 2 so the r^4 terms stay inside float range.
+// Steps are velocity Verlet with tau chosen so r, theta and phi move by about
+// KERR_STEP (relative) each, so a ray costs a few hundred steps rather than
+// the Schwarzschild path's fixed affine stepping.
+const float KERR_STEP = 0.02f;
+
+struct KerrRay {
+    float r, theta, phi;
+    float dr, dtheta;               // Mino-time derivatives
+    float L, Q;                     // per unit energy
+};
+
+// BL position (units of M) to scene position (units of M).
+inline glm::vec3 kerrToScene(float r, float theta, float phi, float a) {
+    float rho = std::sqrt(r*r + a*a) * std::sin(theta);
+    return glm::vec3(rho * std::sin(phi), r * std::cos(theta), rho * std::cos(phi));
+}
+
+// Photon through scene point pos (units of M) along scene direction dir; the
+// constants of motion come from the BL metric at pos, like initRay's E.
+inline KerrRay initKerrRay(glm::vec3 pos, glm::vec3 dir, float a) {
+    float X = pos.z, Y = pos.x, Z = pos.y;
+    float dX = dir.z, dY = dir.x, dZ = dir.y;
+    float a2 = a * a;
+    float w = X*X + Y*Y + Z*Z - a2;
+    float root = std::sqrt(w*w + 4.0f * a2 * Z*Z);
+    KerrRay k;
+    float r2 = 0.5f * (w + root);
+    float r = std::sqrt(r2);
+    k.r = r;
+    k.theta = std::acos(glm::clamp(Z / r, -1.0f, 1.0f));
+    k.phi = std::atan2(Y, X);
+
+    // BL coordinate velocity along dir
+    float vr = (r2 * (X*dX + Y*dY + Z*dZ) + a2 * Z * dZ) / (r * root);
+    float st = std::sin(k.theta), ct = std::cos(k.theta);
+    float vtheta = (Z * vr - r * dZ) / (r2 * st);
+    float vphi = (X * dY - Y * dX) / (X*X + Y*Y);
+
+    float sigma = r2 + a2 * ct*ct;
+    float delta = r2 - 2.0f * r + a2;
+    float s2 = st * st;
+    float gtt = -(1.0f - 2.0f * r / sigma);
+    float gtp = -2.0f * a * r * s2 / sigma;
+    float gpp = (r2 + a2 + 2.0f * a2 * r * s2 / sigma) * s2;
+    // null condition, future-directed root for dt
+    float A = gtt, B = 2.0f * gtp * vphi;
+    float C = gpp * vphi*vphi + sigma / delta * vr*vr + sigma * vtheta*vtheta;
+    float vt = (-B - std::sqrt(std::max(B*B - 4.0f*A*C, 0.0f))) / (2.0f * A);
+
+    float E = -(gtt * vt + gtp * vphi);
+    float L = (gtp * vt + gpp * vphi) / E;
+    float ptheta = sigma * vtheta / E;
+    k.L = L;
+    k.Q = ptheta*ptheta + ct*ct * (L*L / s2 - a2);
+    k.dr = sigma * vr / E;
+    k.dtheta = ptheta;
+    return k;
+}
+
+// Right-hand side at (r, theta): r'' and theta'' (halved R', Theta'), phi',
+// and R, Theta themselves for putting r', theta' back on the constraint.
+struct KerrForce { float d2r, d2t, dphi, R, T, st, ct; };
+inline KerrForce kerrForce(float r, float theta, float L, float Q, float a) {
+    const float a2 = a * a;
+    float st = std::sin(theta), ct = std::cos(theta);
+    st = std::copysign(std::max(std::fabs(st), 1e-6f), st);
+    float s2 = st * st;
+    float P = r*r + a2 - a * L;
+    float K = (L - a) * (L - a) + Q;
+    float delta = r*r - 2.0f * r + a2;
+    KerrForce f;
+    f.d2r = 2.0f * r * P - (r - 1.0f) * K;
+    f.d2t = -a2 * st * ct + L*L * ct / (s2 * st);
+    f.dphi = a * P / delta - a + L / s2;
+    f.R = P*P - delta * K;
+    f.T = Q + ct*ct * (a2 - L*L / s2);
+    f.st = st; f.ct = ct;
+    return f;
+}
+
+struct KerrPacket {
+    float r[LANES], theta[LANES], phi[LANES];
+    float dr[LANES], dtheta[LANES];
+    float L[LANES], Q[LANES];
+    float d2r[LANES], d2t[LANES], dphi[LANES]; // kerrForce at the current point
+    float x[LANES], y[LANES], z[LANES];      // scene position (m)
+    float px[LANES], py[LANES], pz[LANES];   // previous position
+    int   steps[LANES];
+    int   pixel[LANES];
+    float a = 0.0f, M = 1.0f;
+    float horizon = 2.0f, escape = 1e3f;     // units of M
+
+    void setup(const TraceParams& p) {
+        a = glm::clamp(p.spin, -0.999f, 0.999f);
+        M = 0.5f * p.rs;
+        horizon = 1.0f + std::sqrt(1.0f - a*a) + 1e-2f;
+        // past everything that can be hit, an outgoing photon stays outgoing
+        float far = std::max(glm::length(p.cam.pos), p.disk.r2 + DISK_CUTOFF * std::max(p.disk.thickness, 0.0f));
+        for (int i = 0; i < p.objects.numObjects; ++i)
+            far = std::max(far, glm::length(glm::vec3(p.objects.posRadius[i])) + p.objects.posRadius[i].w);
+        escape = std::max(1.05f * far / M, 10.0f);
+    }
+    void load(int l, const TraceParams& p, int pix, int px_, int py_, int W, int H) {
+        KerrRay k = initKerrRay(p.cam.pos / M, primaryDirection(p, px_, py_, W, H), a);
+        r[l] = k.r; theta[l] = k.theta; phi[l] = k.phi;
+        dr[l] = k.dr; dtheta[l] = k.dtheta;
+        L[l] = k.L; Q[l] = k.Q;
+        KerrForce f = kerrForce(k.r, k.theta, k.L, k.Q, a);
+        d2r[l] = f.d2r; d2t[l] = f.d2t; dphi[l] = f.dphi;
+        x[l] = px[l] = p.cam.pos.x;
+        y[l] = py[l] = p.cam.pos.y;
+        z[l] = pz[l] = p.cam.pos.z;
+        steps[l] = 0;
+        pixel[l] = pix;
+    }
+    void park(int l) {
+        pixel[l] = -1;
+        r[l] = 2.0f * horizon; theta[l] = 1.0f; phi[l] = 0.0f;
+        dr[l] = dtheta[l] = L[l] = Q[l] = 0.0f;
+        d2r[l] = d2t[l] = dphi[l] = 0.0f;
+        x[l] = y[l] = z[l] = 0.0f;
+        steps[l] = 0;
+    }
+    bool insideHorizon(int l) const { return r[l] <= horizon; }
+    bool escaped(int l) const { return r[l] > escape && dr[l] > 0.0f; }
+
+    // Velocity Verlet: one kerrForce per step, reused as the next step's start.
+    void step() {
+        const float a2 = a * a;
+        #pragma omp simd
+        for (int l = 0; l < LANES; ++l) {
+            float rr = r[l], th = theta[l];
+            // frame dragging blows phi' up at the horizon; weight it by
+            // Delta / (r^2 + a^2) so the step stays finite there
+            float delta = rr*rr - 2.0f * rr + a2;
+            float rate = std::fabs(dr[l]) / rr + std::fabs(dtheta[l])
+                       + std::fabs(dphi[l]) * delta / (rr*rr + a2) + 1e-6f;
+            float h = KERR_STEP / rate;
+
+            float vr = dr[l] + 0.5f * h * d2r[l];
+            float vt = dtheta[l] + 0.5f * h * d2t[l];
+            rr += h * vr;
+            th += h * vt;
+            KerrForce f = kerrForce(rr, th, L[l], Q[l], a);
+            float ph = phi[l] + 0.5f * h * (dphi[l] + f.dphi);
+            vr += 0.5f * h * f.d2r;
+            vt += 0.5f * h * f.d2t;
+
+            // back onto r'^2 = R(r), theta'^2 = Theta(theta): the second order
+            // update only picks the sign, which carries rays through turning
+            // points; the magnitudes would drift off the constraint otherwise
+            dr[l] = std::copysign(std::sqrt(std::max(f.R, 0.0f)), vr);
+            dtheta[l] = std::copysign(std::sqrt(std::max(f.T, 0.0f)), vt);
+            d2r[l] = f.d2r; d2t[l] = f.d2t; dphi[l] = f.dphi;
+            r[l] = rr; theta[l] = th; phi[l] = ph;
+
+            px[l] = x[l]; py[l] = y[l]; pz[l] = z[l];
+            float rho = std::sqrt(rr*rr + a2) * f.st * M;
+            x[l] = rho * std::sin(ph);
+            y[l] = rr * f.ct * M;
+            z[l] = rho * std::cos(ph);
+        }
+    }
+};
+
+// Traces the pixels [x0,x1) x [y0,y1) of a W x H image into fb; adds the
+// integration steps taken to *steps if given.
+template <class Packet>
+inline void tracePackets(const TraceParams& p, int x0, int y0, int x1, int y1, int W, int H,
+                         CpuFramebuffer& fb, int64_t* steps) {
+    const int tw = x1 - x0;
+    const int count = tw * (y1 - y0);
+    int nextPixel = 0;
+    Packet pk;
+    pk.setup(p);
+    const bool thick = p.disk.thickness > 0.0f;
+    const float footprint = pixelFootprint(p, W, H);
+    glm::vec3 glow[LANES];                   // volumetric disk light picked up so far
+    float trans[LANES];                      // and the transmittance in front of it
+    int live = 0;
+    int64_t taken = 0;
+    for (int l = 0; l < LANES; ++l) {
+        glow[l] = glm::vec3(0.0f);
+        trans[l] = 1.0f;
+        if (nextPixel < count) {
+            int i = nextPixel++;
+            pk.load(l, p, i, x0 + i % tw, y0 + i / tw, W, H);
+            ++live;
+        } else {
+            pk.park(l);
+        }
+    }
+
+    const int n = p.objects.numObjects;
+    while (live > 0) {
+        // same order as the shader: horizon test, step, disk, objects, escape
+        int hit[LANES], obj[LANES];
+        for (int l = 0; l < LANES; ++l) {
+            hit[l] = -1; obj[l] = -1;
+            if (pk.pixel[l] >= 0 && pk.insideHorizon(l)) hit[l] = HIT_BLACK_HOLE;
+        }
+        pk.step();
+        for (int l = 0; l < LANES; ++l) {
+            if (pk.pixel[l] < 0 || hit[l] >= 0) continue;
+            if (thick) {
+                marchDisk(p.disk, glm::vec3(pk.px[l], pk.py[l], pk.pz[l]),
+                          glm::vec3(pk.x[l], pk.y[l], pk.z[l]), glow[l], trans[l]);
+                if (trans[l] < DISK_T_MIN) hit[l] = HIT_DISK;
+                continue;
+            }
+            bool crossed = pk.py[l] * pk.y[l] < 0.0f;
+            float rd = std::sqrt(pk.x[l]*pk.x[l] + pk.z[l]*pk.z[l]);
+            if (crossed && rd >= p.disk.r1 && rd <= p.disk.r2) hit[l] = HIT_DISK;
+        }
+        for (int i = 0; i < n; ++i) {
+            glm::vec4 s = p.objects.posRadius[i];
+            for (int l = 0; l < LANES; ++l) {
+                float dx = pk.x[l] - s.x, dy = pk.y[l] - s.y, dz = pk.z[l] - s.z;
+                if (obj[l] < 0 && hit[l] < 0 && std::sqrt(dx*dx + dy*dy + dz*dz) <= s.w) obj[l] = i;
+            }
+        }
+        for (int l = 0; l < LANES; ++l) {
+            if (pk.pixel[l] < 0) continue;
+            if (hit[l] < 0 && obj[l] >= 0) hit[l] = HIT_OBJECT;
+            if (hit[l] < 0 && (++pk.steps[l] >= MAX_STEPS || pk.escaped(l))) hit[l] = HIT_NONE;
+            if (hit[l] < 0) continue;
+
+            // the horizon test fires before the step, so shade with the pre-step position
+            glm::vec3 P = hit[l] == HIT_BLACK_HOLE ? glm::vec3(pk.px[l], pk.py[l], pk.pz[l])
+                                                   : glm::vec3(pk.x[l], pk.y[l], pk.z[l]);
+            int i = pk.pixel[l];
+            glm::vec4 c = shade(p, hit[l], obj[l], P);
+            if (hit[l] == HIT_NONE && p.stars)
+                c = background(p, P - glm::vec3(pk.px[l], pk.py[l], pk.pz[l]), footprint);
+            if (thick) c = composite(glow[l], trans[l], hit[l] == HIT_DISK ? glm::vec4(0.0f) : c);
+            fb.store(x0 + i % tw, y0 + i / tw, c);
+            taken += pk.steps[l];
+            glow[l] = glm::vec3(0.0f);
+            trans[l] = 1.0f;
+            if (nextPixel < count) {
+                i = nextPixel++;
+                pk.load(l, p, i, x0 + i % tw, y0 + i / tw, W, H);
+            } else {
+                pk.park(l);
+                --live;
+            }
+        }
+    }
+    if (steps) *steps += taken;
+}
+
+inline void traceTile(const TraceParams& p, int x0, int y0, int x1, int y1, int W, int H,
+                      CpuFramebuffer& fb, int64_t* steps = nullptr) {
+    if (p.spin != 0.0f) tracePackets<KerrPacket>(p, x0, y0, x1, y1, W, H, fb, steps);
+    else                tracePackets<RayPacket>(p, x0, y0, x1, y1, W, H, fb, steps);
+}
+
+// Traces [x0,x1) x [y0,y1) of a W x H image into fb in TILE x TILE tiles.
+// If bandSeconds is given, the thread time spent on each TILE-row band is
+// added to (*bandSeconds)[(y - y0) / TILE]; steps counts integration steps.
+inline void traceRegion(TaskRunner& pool, const TraceParams& p, int W, int H,
+                        int x0, int y0, int x1, int y1, CpuFramebuffer& fb,
+                        std::vector<double>* bandSeconds = nullptr,
+                        std::atomic<int64_t>* steps = nullptr) {
+    if (x0 >= x1 || y0 >= y1) return;
+    const int tilesX = (x1 - x0 + TILE - 1) / TILE;
+    const int bands = (y1 - y0 + TILE - 1) / TILE;
+    std::vector<std::atomic<int64_t>> bandNanos(bandSeconds ? bands : 0);
+    for (auto& n : bandNanos) n = 0;
+
+    pool.parallelFor(tilesX * bands, [&](int t) {
+        auto t0 = std::chrono::steady_clock::now();
+        int tx = x0 + (t % tilesX) * TILE, ty = y0 + (t / tilesX) * TILE;
+        int64_t tileSteps = 0;
+        traceTile(p, tx, ty, std::min(tx + TILE, x1), std::min(ty + TILE, y1), W, H, fb,
+                  steps ? &tileSteps : nullptr);
+        if (steps) *steps += tileSteps;
+        if (bandSeconds)
+            bandNanos[t / tilesX] += std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now() - t0).count();
+    });
+
+    if (bandSeconds) {
+        if (int(bandSeconds->size()) < bands) bandSeconds->resize(bands, 0.0);
+        for (int b = 0; b < bands; ++b)
+            (*bandSeconds)[b] += bandNanos[b] * 1e-9;
+    }
+}
+
+// CPU equivalent of glDispatchCompute over rows [rowBegin, rowEnd) of a
+// fb.width x fb.height image (rowEnd < 0 = all rows). rowBegin must be a
+// multiple of TILE; bandSeconds is indexed by y / TILE.
+inline void dispatchCompute(TaskRunner& pool, const TraceParams& p, CpuFramebuffer& fb,
+                            int rowBegin = 0, int rowEnd = -1,
+                            std::vector<double>* bandSeconds = nullptr) {
+    const int W = fb.width, H = fb.height;
+    if (rowEnd < 0 || rowEnd > H) rowEnd = H;
+    if (rowBegin >= rowEnd) return;
+    std::vector<double> bands;
+    traceRegion(pool, p, W, H, 0, rowBegin, W, rowEnd, fb, bandSeconds ? &bands : nullptr);
+    if (bandSeconds) {
+        const int first = rowBegin / TILE;
+        if (int(bandSeconds->size()) < first + int(bands.size()))
+            bandSeconds->resize(first + bands.size(), 0.0);
+        for (size_t b = 0; b < bands.size(); ++b)
+            (*bandSeconds)[first + b] += bands[b];
+    }
+}
+
+// Pinhole camera looking from pos at target with vertical field of view fovY (degrees).
+inline CameraUBO makeCamera(glm::vec3 pos, glm::vec3 target, float fovY, float aspect) {
+    CameraUBO cam = {};
+    glm::vec3 fwd = glm::normalize(target - pos);
+    glm::vec3 up = glm::vec3(0, 1, 0); // y axis is up, so disk is in x-z plane
+    glm::vec3 right = glm::normalize(glm::cross(fwd, up));
+    up = glm::cross(right, fwd);
+    cam.pos = pos;
+    cam.right = right;
+    cam.up = up;
+    cam.forward = fwd;
+    cam.tanHalfFov = std::tan(glm::radians(fovY * 0.5f));
+    cam.aspect = aspect;
+    return cam;
+}
+
+} // namespace cpu
@@ -1,5 +1,6 @@
 #version 330 core
+in vec3 lineColor;
 out vec4 FragColor;
 void main() {
-    FragColor = vec4(0.5, 0.5, 0.5, 0.7); // translucent blue lines
+    FragColor = vec4(lineColor, 0.7); // translucent lines, coloured by grid.vert
 }
@@ -1,6 +1,48 @@
 #version 330 core
-layout(location = 0) in vec3 aPos;
+// The spacetime grid. The mesh is a static (gridSize+1)^2 lattice with no
+// vertex buffers: each vertex finds its lattice point from gl_VertexID and
+// sinks into a Flamm paraboloid, 2 sqrt(r_s (d - r_s)), under every object,
+// d being its distance to the object in the xz plane. The CPU only sets the
+// uniforms, so the grid's resolution costs it nothing.
+const int MAX_WARP = 16;          // MAX_OBJECTS
+const int COLOR_DISTANCE = 1, COLOR_VELOCITY = 2;   // GravityLineColorMode
+
 uniform mat4 viewProj;
+uniform int gridSize;             // cells per side
+uniform float gridSpacing;
+uniform int numWarp;
+uniform vec4 warpPosRs[MAX_WARP]; // xyz: position, w: Schwarzschild radius
+uniform float warpSpeed[MAX_WARP];
+uniform int colorMode;
+uniform vec3 fixedColor;
+uniform vec4 holePosRs;           // Sagittarius A*, w: Schwarzschild radius
+out vec3 lineColor;
+
 void main() {
-    gl_Position = viewProj * vec4(aPos, 1.0);
+    int x = gl_VertexID % (gridSize + 1), z = gl_VertexID / (gridSize + 1);
+    vec3 p = vec3(float(x - gridSize / 2) * gridSpacing, 0.0, float(z - gridSize / 2) * gridSpacing);
+    for (int i = 0; i < numWarp; ++i) {
+        float rs = warpPosRs[i].w;
+        float d = distance(p.xz, warpPosRs[i].xz);
+        p.y += (d > rs ? 2.0 * sqrt(rs * (d - rs)) : 2.0 * rs) - 3e10;
+    }
+    gl_Position = viewProj * vec4(p, 1.0);
+
+    lineColor = fixedColor;
+    if (colorMode == COLOR_DISTANCE) {
+        // blue = far from the hole, red = close
+        float t = clamp((distance(p, holePosRs.xyz) - holePosRs.w) / 1e12, 0.0, 1.0);
+        lineColor = mix(vec3(1.0, 0.0, 0.0), vec3(0.0, 0.0, 1.0), t);
+    } else if (colorMode == COLOR_VELOCITY) {
+        // speed of the closest object, green to yellow
+        float closest = 1e20, speed = 0.0;
+        for (int i = 0; i < numWarp; ++i) {
+            float d = distance(p, warpPosRs[i].xyz);
+            if (d < closest) {
+                closest = d;
+                speed = warpSpeed[i];
+            }
+        }
+        lineColor = mix(vec3(0.0, 1.0, 0.0), vec3(1.0, 1.0, 0.0), clamp(speed / 1e7, 0.0, 1.0));
+    }
 }
@@ -0,0 +1,204 @@
+#pragma once
+// Streaming image writers. Rows are handed over top row first and go straight
+// to disk, so memory use doesn't depend on the image height and the file is
+// written strictly sequentially.
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+#include <algorithm>
+#include <string>
+#include <vector>
+#ifdef BH_HAVE_ZLIB
+#include <zlib.h>
+#endif
+
+struct ImageStreamWriter {
+    virtual ~ImageStreamWriter() {}
+    // One row of width RGBA8 pixels; alpha is dropped.
+    virtual bool writeRow(const uint8_t* rgba) = 0;
+    // Flushes trailers and closes the file.
+    virtual bool finish() = 0;
+};
+
+// -- PPM -- //
+struct PPMStreamWriter : ImageStreamWriter {
+    FILE* f = nullptr;
+    int width = 0;
+    std::vector<uint8_t> row;
+
+    bool open(const char* path, int w, int h) {
+        f = std::fopen(path, "wb");
+        if (!f) return false;
+        width = w;
+        row.resize(size_t(w) * 3);
+        return std::fprintf(f, "P6\n%d %d\n255\n", w, h) > 0;
+    }
+    bool writeRow(const uint8_t* rgba) override {
+        for (int x = 0; x < width; ++x) {
+            row[x*3+0] = rgba[x*4+0];
+            row[x*3+1] = rgba[x*4+1];
+            row[x*3+2] = rgba[x*4+2];
+        }
+        return std::fwrite(row.data(), 1, row.size(), f) == row.size();
+    }
+    bool finish() override {
+        bool ok = f && std::fclose(f) == 0;
+        f = nullptr;
+        return ok;
+    }
+    ~PPMStreamWriter() { if (f) std::fclose(f); }
+};
+
+// -- PNG -- //
+// 8-bit RGB, Sub filter on every row. The zlib stream is cut into IDAT chunks
+// as it is produced. Without zlib the stream is made of stored (uncompressed)
+// deflate blocks, which any PNG reader accepts.
+struct PNGStreamWriter : ImageStreamWriter {
+    FILE* f = nullptr;
+    int width = 0;
+    bool ok = true;
+    std::vector<uint8_t> line;     // filter byte + filtered RGB row
+    std::vector<uint8_t> idat;     // pending IDAT payload
+    static constexpr size_t CHUNK = 1 << 20;
+#ifdef BH_HAVE_ZLIB
+    z_stream zs = {};
+#else
+    uint32_t adlerA = 1, adlerB = 0;
+#endif
+
+    static uint32_t crc32(uint32_t crc, const uint8_t* p, size_t n) {
+        static uint32_t table[256];
+        static bool init = false;
+        if (!init) {
+            for (uint32_t i = 0; i < 256; ++i) {
+                uint32_t c = i;
+                for (int k = 0; k < 8; ++k) c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+                table[i] = c;
+            }
+            init = true;
+        }
+        crc = ~crc;
+        for (size_t i = 0; i < n; ++i) crc = table[(crc ^ p[i]) & 0xFF] ^ (crc >> 8);
+        return ~crc;
+    }
+    static void put32(uint8_t* p, uint32_t v) {
+        p[0] = uint8_t(v >> 24); p[1] = uint8_t(v >> 16); p[2] = uint8_t(v >> 8); p[3] = uint8_t(v);
+    }
+    void chunk(const char* type, const uint8_t* data, size_t n) {
+        uint8_t head[8];
+        put32(head, uint32_t(n));
+        std::memcpy(head + 4, type, 4);
+        uint32_t crc = crc32(crc32(0, head + 4, 4), data, n);
+        uint8_t tail[4];
+        put32(tail, crc);
+        ok = ok && std::fwrite(head, 1, 8, f) == 8
+                && (n == 0 || std::fwrite(data, 1, n, f) == n)
+                && std::fwrite(tail, 1, 4, f) == 4;
+    }
+    void flushIdat(bool all) {
+        while (idat.size() >= CHUNK || (all && !idat.empty())) {
+            size_t n = std::min(idat.size(), CHUNK);
+            chunk("IDAT", idat.data(), n);
+            idat.erase(idat.begin(), idat.begin() + n);
+        }
+    }
+
+    bool open(const char* path, int w, int h) {
+        f = std::fopen(path, "wb");
+        if (!f) return false;
+        width = w;
+        line.resize(1 + size_t(w) * 3);
+        static const uint8_t sig[8] = { 137, 'P', 'N', 'G', '\r', '\n', 26, '\n' };
+        std::fwrite(sig, 1, 8, f);
+        uint8_t ihdr[13];
+        put32(ihdr, uint32_t(w));
+        put32(ihdr + 4, uint32_t(h));
+        ihdr[8] = 8;   // bit depth
+        ihdr[9] = 2;   // RGB
+        ihdr[10] = ihdr[11] = ihdr[12] = 0;
+        chunk("IHDR", ihdr, sizeof(ihdr));
+#ifdef BH_HAVE_ZLIB
+        if (deflateInit(&zs, 6) != Z_OK) return false;
+#else
+        idat.push_back(0x78);  // zlib header: deflate, 32K window, no dictionary
+        idat.push_back(0x01);
+#endif
+        return ok;
+    }
+
+    void deflateLine(bool last) {
+#ifdef BH_HAVE_ZLIB
+        zs.next_in = line.data();
+        zs.avail_in = last ? 0 : uInt(line.size());
+        uint8_t out[1 << 16];
+        int rc;
+        do {
+            zs.next_out = out;
+            zs.avail_out = sizeof(out);
+            rc = deflate(&zs, last ? Z_FINISH : Z_NO_FLUSH);
+            idat.insert(idat.end(), out, out + (sizeof(out) - zs.avail_out));
+        } while (zs.avail_out == 0 || (last && rc != Z_STREAM_END));
+#else
+        if (!last) {
+            for (size_t off = 0; off < line.size(); ) {
+                size_t n = std::min<size_t>(line.size() - off, 65535);
+                idat.push_back(0x00);  // stored block, not final
+                idat.push_back(uint8_t(n)); idat.push_back(uint8_t(n >> 8));
+                idat.push_back(uint8_t(~n)); idat.push_back(uint8_t(~n >> 8));
+                idat.insert(idat.end(), line.begin() + off, line.begin() + off + n);
+                off += n;
+            }
+            for (uint8_t b : line) {
+                adlerA = (adlerA + b) % 65521;
+                adlerB = (adlerB + adlerA) % 65521;
+            }
+        } else {
+            const uint8_t tail[5] = { 0x01, 0x00, 0x00, 0xFF, 0xFF };  // empty final block
+            idat.insert(idat.end(), tail, tail + 5);
+            uint8_t adler[4];
+            put32(adler, (adlerB << 16) | adlerA);
+            idat.insert(idat.end(), adler, adler + 4);
+        }
+#endif
+        flushIdat(last);
+    }
+
+    bool writeRow(const uint8_t* rgba) override {
+        line[0] = 1;   // Sub filter
+        uint8_t* out = &line[1];
+        for (int x = 0; x < width; ++x)
+            for (int c = 0; c < 3; ++c) {
+                uint8_t left = x > 0 ? rgba[(x-1)*4 + c] : 0;
+                out[x*3 + c] = uint8_t(rgba[x*4 + c] - left);
+            }
+        deflateLine(false);
+        return ok;
+    }
+    bool finish() override {
+        if (!f) return false;
+        deflateLine(true);
+#ifdef BH_HAVE_ZLIB
+        deflateEnd(&zs);
+#endif
+        chunk("IEND", nullptr, 0);
+        ok = std::fclose(f) == 0 && ok;
+        f = nullptr;
+        return ok;
+    }
+    ~PNGStreamWriter() { if (f) std::fclose(f); }
+};
+
+// Picks the writer from the file extension (.png, anything else is PPM).
+inline ImageStreamWriter* openImageStream(const std::string& path, int w, int h) {
+    bool png = path.size() >= 4 && path.compare(path.size() - 4, 4, ".png") == 0;
+    if (png) {
+        auto* wr = new PNGStreamWriter();
+        if (wr->open(path.c_str(), w, h)) return wr;
+        delete wr;
+    } else {
+        auto* wr = new PPMStreamWriter();
+        if (wr->open(path.c_str(), w, h)) return wr;
+        delete wr;
+    }
+    return nullptr;
+}
@@ -0,0 +1,226 @@
+#pragma once
+// Frame profiler for BlackHole3D. CPU zones are scoped (ProfileZone) and land
+// in a ring per thread that only that thread writes, so recording takes no
+// lock; GPU zones (GpuZone) are GL_TIMESTAMP pairs around GL commands,
+// collected a few frames later without waiting and put on the CPU timeline.
+// A dump writes everything still in the rings as Chrome trace-event JSON
+// (chrome://tracing, ui.perfetto.dev) and prints p50/p95/p99 per zone.
+// Off unless enabled, a zone then costs one branch.
+#include <GL/glew.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+struct ProfileEvent {
+    const char* name;              // a string literal, never copied
+    int64_t start, duration;       // ns since Profiler::origin
+};
+
+// Single writer; readers copy what is there and drop entries the writer may
+// have overwritten meanwhile.
+struct ProfileRing {
+    static const uint64_t CAPACITY = 1 << 16;   // events, a power of two
+    std::string track;
+    int tid = 0;
+    std::unique_ptr<ProfileEvent[]> events{ new ProfileEvent[CAPACITY] };
+    std::atomic<uint64_t> head{ 0 };
+
+    void push(const ProfileEvent& e) {
+        uint64_t h = head.load(std::memory_order_relaxed);
+        events[h & (CAPACITY - 1)] = e;
+        head.store(h + 1, std::memory_order_release);
+    }
+    void snapshot(std::vector<ProfileEvent>& out) const {
+        uint64_t end = head.load(std::memory_order_acquire);
+        uint64_t begin = end > CAPACITY ? end - CAPACITY : 0;
+        std::vector<ProfileEvent> copy;
+        for (uint64_t i = begin; i < end; ++i) copy.push_back(events[i & (CAPACITY - 1)]);
+        uint64_t after = head.load(std::memory_order_acquire);
+        uint64_t safe = after > CAPACITY ? after - CAPACITY : 0;   // older ones may be torn
+        for (uint64_t i = std::max(begin, safe); i < end; ++i) out.push_back(copy[i - begin]);
+    }
+};
+
+struct Profiler {
+    bool enabled = false;
+    std::string path;                        // trace JSON written here by dump()
+    std::atomic<bool> dumpRequested{ false };
+    std::chrono::steady_clock::time_point origin = std::chrono::steady_clock::now();
+    std::mutex lock;                         // guards rings, taken once per thread
+    std::vector<std::unique_ptr<ProfileRing>> rings;
+
+    int64_t now() const {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - origin).count();
+    }
+    ProfileRing* addRing(const std::string& track) {
+        std::lock_guard<std::mutex> g(lock);
+        rings.emplace_back(new ProfileRing());
+        rings.back()->track = track;
+        rings.back()->tid = int(rings.size());
+        return rings.back().get();
+    }
+    // this thread's ring, created (as "thread <n>" unless named first) on first use
+    ProfileRing* threadRing(const char* name = nullptr) {
+        thread_local ProfileRing* ring = nullptr;
+        if (!ring) ring = addRing(name ? name : "thread " + std::to_string(rings.size() + 1));
+        return ring;
+    }
+
+    // Writes the trace and prints each zone's percentiles, slowest p95 first;
+    // zones whose p95 is over budgetSec are flagged.
+    bool dump(double budgetSec) {
+        std::vector<std::pair<const ProfileRing*, std::vector<ProfileEvent>>> tracks;
+        {
+            std::lock_guard<std::mutex> g(lock);
+            for (const auto& r : rings) {
+                tracks.emplace_back(r.get(), std::vector<ProfileEvent>());
+                r->snapshot(tracks.back().second);
+            }
+        }
+        bool ok = writeTrace(tracks);
+        if (ok) std::cout << "[PROF] Wrote trace to " << path << "\n";
+        else std::cerr << "[WARN] Failed to write " << path << "\n";
+
+        struct Row { std::string zone; size_t n; double p50, p95, p99; };
+        std::vector<Row> rows;
+        for (const auto& t : tracks) {
+            std::map<std::string, std::vector<int64_t>> byName;
+            for (const ProfileEvent& e : t.second) byName[e.name].push_back(e.duration);
+            for (auto& z : byName) {
+                std::vector<int64_t>& d = z.second;
+                std::sort(d.begin(), d.end());
+                auto pct = [&d](double p) { return d[std::min(d.size() - 1, size_t(p * d.size()))] * 1e-6; };
+                rows.push_back({ t.first->track + "/" + z.first, d.size(), pct(0.50), pct(0.95), pct(0.99) });
+            }
+        }
+        std::sort(rows.begin(), rows.end(), [](const Row& a, const Row& b) { return a.p95 > b.p95; });
+        std::printf("[PROF] %-28s %7s %9s %9s %9s  (ms, budget %.2f)\n", "zone", "n", "p50", "p95", "p99",
+                    budgetSec * 1000.0);
+        for (const Row& r : rows)
+            std::printf("[PROF] %-28s %7zu %9.3f %9.3f %9.3f%s\n", r.zone.c_str(), r.n, r.p50, r.p95, r.p99,
+                        r.p95 > budgetSec * 1000.0 ? "  over budget" : "");
+        std::fflush(stdout);
+        return ok;
+    }
+    bool writeTrace(const std::vector<std::pair<const ProfileRing*, std::vector<ProfileEvent>>>& tracks) const {
+        FILE* f = std::fopen(path.c_str(), "w");
+        if (!f) return false;
+        std::fprintf(f, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+        bool first = true;
+        for (const auto& t : tracks) {
+            std::fprintf(f, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":\"%s\"}}",
+                         first ? "" : ",\n", t.first->tid, t.first->track.c_str());
+            first = false;
+            for (const ProfileEvent& e : t.second)
+                std::fprintf(f, ",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f}",
+                             e.name, t.first->tid, e.start * 1e-3, e.duration * 1e-3);
+        }
+        std::fprintf(f, "\n]}\n");
+        return std::fclose(f) == 0;
+    }
+};
+
+inline Profiler& profiler() {
+    static Profiler p;
+    return p;
+}
+
+struct ProfileZone {
+    const char* name;
+    int64_t start;
+    explicit ProfileZone(const char* n) : name(n), start(profiler().enabled ? profiler().now() : -1) {}
+    ~ProfileZone() { stop(); }
+    // ends the zone before the scope does
+    void stop() {
+        if (start >= 0) profiler().threadRing()->push({ name, start, profiler().now() - start });
+        start = -1;
+    }
+    ProfileZone(const ProfileZone&) = delete;
+    ProfileZone& operator=(const ProfileZone&) = delete;
+};
+
+// -- GPU zones -- //
+// Timestamp pairs nest, unlike GL_TIME_ELAPSED queries, so GPU zones can sit
+// around commands the engine is already timing. Zones are collected oldest
+// first once their end stamp is available; when all RING slots are pending
+// the oldest is waited for. GPU time is moved onto the CPU clock by an offset
+// measured at init.
+struct GpuProfiler {
+    static const int RING = 128;
+    struct Slot { const char* name = nullptr; GLuint query[2] = {}; bool ended = false; };
+    Slot slots[RING];
+    int next = 0, pending = 0;      // slots next - pending .. next - 1 await collection
+    int64_t offset = 0;             // Profiler ns minus GPU ns
+    ProfileRing* ring = nullptr;    // the "GPU" track, written from the GL thread
+
+    bool ready() const { return ring != nullptr; }
+    // on the GL thread, with a context current
+    void init() {
+        for (Slot& s : slots) glGenQueries(2, s.query);
+        GLint64 gpuNow = 0;
+        glGetInteger64v(GL_TIMESTAMP, &gpuNow);
+        offset = profiler().now() - gpuNow;
+        ring = profiler().addRing("GPU");
+    }
+    int begin(const char* name) {
+        if (!ready()) return -1;
+        collect(false);
+        if (pending == RING) collect(true);
+        if (pending == RING) return -1;     // RING zones still open, nothing to reuse
+        int i = next;
+        next = (next + 1) % RING;
+        ++pending;
+        slots[i].name = name;
+        slots[i].ended = false;
+        glQueryCounter(slots[i].query[0], GL_TIMESTAMP);
+        return i;
+    }
+    void end(int i) {
+        if (i < 0) return;
+        glQueryCounter(slots[i].query[1], GL_TIMESTAMP);
+        slots[i].ended = true;
+    }
+    // moves finished zones to the GPU track, oldest first, up to the first
+    // open one; wait blocks on the oldest instead of stopping at it
+    void collect(bool wait) {
+        while (pending > 0) {
+            Slot& s = slots[(next - pending + RING) % RING];
+            if (!s.ended) return;
+            GLint available = 0;
+            glGetQueryObjectiv(s.query[1], GL_QUERY_RESULT_AVAILABLE, &available);
+            if (!available && !wait) return;
+            GLuint64 t0 = 0, t1 = 0;
+            glGetQueryObjectui64v(s.query[0], GL_QUERY_RESULT, &t0);
+            glGetQueryObjectui64v(s.query[1], GL_QUERY_RESULT, &t1);
+            ring->push({ s.name, int64_t(t0) + offset, int64_t(t1 - t0) });
+            --pending;
+            wait = false;
+        }
+    }
+    // waits for every ended zone, for a last dump; a zone still open stays pending
+    void flush() {
+        if (!ready()) return;
+        while (pending > 0 && slots[(next - pending + RING) % RING].ended) collect(true);
+    }
+};
+
+inline GpuProfiler& gpuProfiler() {
+    static GpuProfiler p;
+    return p;
+}
+
+struct GpuZone {
+    int slot;
+    explicit GpuZone(const char* name) : slot(gpuProfiler().begin(name)) {}
+    ~GpuZone() { gpuProfiler().end(slot); }
+    GpuZone(const GpuZone&) = delete;
+    GpuZone& operator=(const GpuZone&) = delete;
+};
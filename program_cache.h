@@ -0,0 +1,188 @@
+#pragma once
+// GL program builds for BlackHole3D: linked programs are kept on disk with
+// glGetProgramBinary, keyed by a hash of their sources and the driver (vendor,
+// renderer and version strings), so a second launch links nothing. Programs
+// not in the cache are compiled without waiting on them; with
+// KHR/ARB_parallel_shader_compile the driver builds them on its own threads
+// and ready() can be polled each frame, otherwise the first query blocks.
+// A binary the driver rejects (updated in place, say) is simply rebuilt.
+#include <GL/glew.h>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+struct ProgramCache {
+    std::string dir;              // empty = no disk cache
+    std::string driver;           // part of every key
+    bool parallel = false;        // completion can be polled without blocking
+    int hits = 0, builds = 0;
+
+    void init(const std::string& cacheDir) {
+        driver = std::string((const char*)glGetString(GL_VENDOR)) + "\n" +
+                 (const char*)glGetString(GL_RENDERER) + "\n" + (const char*)glGetString(GL_VERSION);
+        // program binaries are core in 4.1, the CPU backend's 3.3 context may lack them
+        GLint formats = 0;
+        if (GLEW_ARB_get_program_binary) glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+        if (!cacheDir.empty() && formats > 0) {
+            std::error_code ec;
+            std::filesystem::create_directories(cacheDir, ec);
+            if (!ec) dir = cacheDir;
+        }
+        if (GLEW_KHR_parallel_shader_compile) {
+            glMaxShaderCompilerThreadsKHR(0xFFFFFFFFu);   // as many as the driver likes
+            parallel = true;
+        } else if (GLEW_ARB_parallel_shader_compile) {
+            glMaxShaderCompilerThreadsARB(0xFFFFFFFFu);
+            parallel = true;
+        }
+    }
+    // FNV-1a over the driver and every stage's type and source
+    uint64_t key(const std::vector<std::pair<GLenum, std::string>>& stages) const {
+        uint64_t h = 1469598103934665603ull;
+        auto mix = [&h](const void* p, size_t n) {
+            for (size_t i = 0; i < n; ++i) h = (h ^ static_cast<const unsigned char*>(p)[i]) * 1099511628211ull;
+        };
+        mix(driver.data(), driver.size());
+        for (const auto& s : stages) {
+            mix(&s.first, sizeof(s.first));
+            mix(s.second.data(), s.second.size());
+        }
+        return h;
+    }
+    std::string path(uint64_t k) const {
+        char name[32];
+        std::snprintf(name, sizeof(name), "%016llx.bin", (unsigned long long)k);
+        return dir + "/" + name;
+    }
+    // true when prog now holds the cached binary for k
+    bool load(GLuint prog, uint64_t k) {
+        if (dir.empty()) return false;
+        std::ifstream in(path(k), std::ios::binary);
+        GLenum format = 0;
+        if (!in.read(reinterpret_cast<char*>(&format), sizeof(format))) return false;
+        std::vector<char> blob((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+        glProgramBinary(prog, format, blob.data(), GLsizei(blob.size()));
+        GLint ok = 0;
+        glGetProgramiv(prog, GL_LINK_STATUS, &ok);
+        if (ok) ++hits;
+        return ok != 0;
+    }
+    void store(GLuint prog, uint64_t k) const {
+        if (dir.empty()) return;
+        GLint length = 0;
+        glGetProgramiv(prog, GL_PROGRAM_BINARY_LENGTH, &length);
+        if (length <= 0) return;
+        std::vector<char> blob(length);
+        GLenum format = 0;
+        glGetProgramBinary(prog, length, nullptr, &format, blob.data());
+        // written aside and renamed, so a crash never leaves half a binary
+        std::string tmp = path(k) + ".tmp";
+        {
+            std::ofstream out(tmp, std::ios::binary);
+            out.write(reinterpret_cast<const char*>(&format), sizeof(format));
+            out.write(blob.data(), blob.size());
+            if (!out) return;
+        }
+        std::error_code ec;
+        std::filesystem::rename(tmp, path(k), ec);
+    }
+};
+
+// src with a block of #defines put right after its #version line
+inline std::string specializeSource(const std::string& src, const std::string& defines) {
+    size_t eol = src.find('\n');
+    if (src.compare(0, 8, "#version") != 0 || eol == std::string::npos) return defines + src;
+    return src.substr(0, eol + 1) + defines + src.substr(eol + 1);
+}
+
+// One program: loaded from the cache at once, or compiled and linked in the
+// background until finish() (or a ready() that returns true) checks it.
+struct ProgramBuild {
+    std::string name;             // for error messages
+    GLuint program = 0;
+    uint64_t key = 0;
+    std::vector<GLuint> shaders;  // still attached while building
+    bool done = false;
+
+    static std::string readSource(const char* path) {
+        std::ifstream in(path);
+        if (!in.is_open()) {
+            std::cerr << "Failed to open shader: " << path << "\n";
+            exit(EXIT_FAILURE);
+        }
+        std::stringstream ss;
+        ss << in.rdbuf();
+        return ss.str();
+    }
+    void start(ProgramCache& cache, const std::string& label,
+               const std::vector<std::pair<GLenum, std::string>>& stages) {
+        name = label;
+        program = glCreateProgram();
+        key = cache.key(stages);
+        if (cache.load(program, key)) {
+            done = true;
+            return;
+        }
+        ++cache.builds;
+        for (const auto& s : stages) {
+            GLuint sh = glCreateShader(s.first);
+            const char* src = s.second.c_str();
+            glShaderSource(sh, 1, &src, nullptr);
+            glCompileShader(sh);
+            glAttachShader(program, sh);
+            shaders.push_back(sh);
+        }
+        if (GLEW_ARB_get_program_binary && !cache.dir.empty())
+            glProgramParameteri(program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+        glLinkProgram(program);
+    }
+    // true once linked; never blocks when the driver compiles in parallel
+    bool ready(ProgramCache& cache) {
+        if (done) return true;
+        if (cache.parallel) {
+            GLint complete = 0;
+            glGetProgramiv(program, GL_COMPLETION_STATUS_KHR, &complete);
+            if (!complete) return false;
+        }
+        finish(cache);
+        return true;
+    }
+    // waits for the link, exits with the driver's log if it failed
+    void finish(ProgramCache& cache) {
+        if (done) return;
+        GLint ok = 0;
+        glGetProgramiv(program, GL_LINK_STATUS, &ok);
+        if (!ok) {
+            for (GLuint sh : shaders) {
+                glGetShaderiv(sh, GL_COMPILE_STATUS, &ok);
+                if (ok) continue;
+                GLint logLen = 0;
+                glGetShaderiv(sh, GL_INFO_LOG_LENGTH, &logLen);
+                std::vector<char> log(logLen + 1);
+                glGetShaderInfoLog(sh, logLen, nullptr, log.data());
+                std::cerr << "Shader compile error (" << name << "):\n" << log.data() << "\n";
+                exit(EXIT_FAILURE);
+            }
+            GLint logLen = 0;
+            glGetProgramiv(program, GL_INFO_LOG_LENGTH, &logLen);
+            std::vector<char> log(logLen + 1);
+            glGetProgramInfoLog(program, logLen, nullptr, log.data());
+            std::cerr << "Shader link error (" << name << "):\n" << log.data() << "\n";
+            exit(EXIT_FAILURE);
+        }
+        for (GLuint sh : shaders) {
+            glDetachShader(program, sh);
+            glDeleteShader(sh);
+        }
+        shaders.clear();
+        cache.store(program, key);
+        done = true;
+    }
+};
@@ -0,0 +1,951 @@
+#include <glm/glm.hpp>
+#include <vector>
+#include <deque>
+#include <map>
+#include <memory>
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include <cstring>
+#include <cstdlib>
+#include <cerrno>
+#include <chrono>
+#include <algorithm>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#define _USE_MATH_DEFINES
+#include <cmath>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <unistd.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <signal.h>
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+#include "geodesic_cpu.h"
+#include "image_writer.h"
+using namespace glm;
+using namespace std;
+using Clock = std::chrono::steady_clock;
+
+// Offline renderer for stills that are too big or too slow for BlackHole3D.
+//   coordinator: splits the frame into tiles and farms them out to workers
+//   worker:      traces tiles with the geodesic_cpu.h tracer and streams them back
+//   still:       single box, streams bands of scanlines to a PNG/PPM with bounded memory
+//   cubemap:     single box, six faces for dome/VR playback, each written as it finishes
+//   bench:       Schwarzschild vs Kerr path throughput on one view
+
+// VARS
+double c = 299792458.0;
+double G = 6.67430e-11;
+
+// -- Scene -- //
+// Same scene as BlackHole3D's startup view.
+struct RenderSettings {
+    int width = 1920, height = 1080;
+    float radius = 6.34194e10f;  // camera orbit radius (m)
+    float azimuth = 0.0f;        // degrees
+    float elevation = 90.0f;     // degrees from +y
+    float fov = 60.0f;           // vertical, degrees
+    int projection = cpu::PROJ_PINHOLE;
+    float spin = 0.0f;           // a = J/M of the hole, about +y
+    float diskThickness = 0.0f;  // scale height of a volumetric disk in r_s, 0 = thin disk
+    string stars;                // BuildStarCatalog file for the background, empty = black
+    float starExposure = 100.0f;
+    int face = 1024;             // cube map face edge (px)
+    int tile = 64;
+    string out = "render.ppm";
+};
+
+// Catalogs stay mapped for the life of the process, so a worker maps its
+// catalog once however many jobs it runs.
+const StarCatalog* loadStars(const string& path) {
+    static map<string, unique_ptr<StarCatalog>> catalogs;
+    if (path.empty()) return nullptr;
+    unique_ptr<StarCatalog>& cat = catalogs[path];
+    if (!cat) {
+        cat.reset(new StarCatalog());
+        string error;
+        if (!cat->open(path.c_str(), &error)) {
+            cerr << error << "\n";
+            exit(EXIT_FAILURE);
+        }
+    }
+    return cat.get();
+}
+
+cpu::TraceParams buildScene(const RenderSettings& s) {
+    const double massSagA = 8.54e36;
+    const float rs = float(2.0 * G * massSagA / (c * c));
+
+    float el = glm::clamp(radians(s.elevation), 0.01f, float(M_PI) - 0.01f);
+    float az = radians(s.azimuth);
+    vec3 pos(s.radius * sin(el) * cos(az), s.radius * cos(el), s.radius * sin(el) * sin(az));
+
+    cpu::TraceParams p = {};
+    p.cam = cpu::makeCamera(pos, vec3(0.0f), s.fov, float(s.width) / float(s.height));
+    p.projection = s.projection;
+    p.spin = s.spin;
+    p.disk.r1 = rs * 2.2f;
+    p.disk.r2 = rs * 5.2f;
+    p.disk.num = 2.0f;
+    p.disk.thickness = s.diskThickness * rs;
+    p.stars = loadStars(s.stars);
+    p.starExposure = s.starExposure;
+
+    struct { vec4 posRadius, color; float mass; } objs[] = {
+        { vec4(4e11f, 0.0f, 0.0f, 4e10f), vec4(1,1,0,1), 1.98892e30f },
+        { vec4(0.0f, 0.0f, 4e11f, 4e10f), vec4(1,0,0,1), 1.98892e30f },
+        { vec4(0.0f, 0.0f, 0.0f, rs),     vec4(0,0,0,1), float(massSagA) },
+    };
+    p.objects.numObjects = 3;
+    for (int i = 0; i < 3; ++i) {
+        p.objects.posRadius[i] = objs[i].posRadius;
+        p.objects.color[i] = objs[i].color;
+        p.objects.mass[i].x = objs[i].mass;
+    }
+    return p;
+}
+
+// -- Wire protocol -- //
+// Every message is a MsgHeader followed by `size` payload bytes. Structs go over
+// the wire as-is, so coordinator and workers must be the same build on machines
+// of the same endianness (loopback or a homogeneous cluster). The star catalog
+// travels as a path that every worker maps itself.
+const uint32_t FARM_MAGIC   = 0x46544842; // "BHTF"
+const uint32_t FARM_VERSION = 6;
+enum MsgType : uint32_t { MSG_HELLO = 1, MSG_JOB, MSG_TILE, MSG_RESULT, MSG_BYE };
+struct MsgHeader { uint32_t type; uint32_t size; };
+struct HelloMsg  { uint32_t magic, version, threads, pid; };
+struct JobMsg    { uint32_t magic; int32_t width, height; cpu::TraceParams params; char stars[256]; };
+struct TileMsg   { int32_t id, x0, y0, x1, y1; };
+// MSG_RESULT payload: TileMsg, then (x1-x0)*(y1-y0) RGBA8 pixels
+
+// -- Sockets -- //
+// "unix:/path/to.sock", "tcp:host:port" or just "host:port"
+struct Endpoint {
+    bool unixSocket = false;
+    string path, host;
+    int port = 0;
+};
+Endpoint parseEndpoint(const string& spec) {
+    Endpoint ep;
+    if (spec.rfind("unix:", 0) == 0) {
+        ep.unixSocket = true;
+        ep.path = spec.substr(5);
+        return ep;
+    }
+    string hp = spec.rfind("tcp:", 0) == 0 ? spec.substr(4) : spec;
+    size_t colon = hp.rfind(':');
+    if (colon == string::npos) {
+        cerr << "Bad endpoint '" << spec << "', expected unix:/path or tcp:host:port\n";
+        exit(EXIT_FAILURE);
+    }
+    ep.host = hp.substr(0, colon);
+    ep.port = atoi(hp.c_str() + colon + 1);
+    return ep;
+}
+int openSocket(const Endpoint& ep, bool listening) {
+    int fd = -1;
+    if (ep.unixSocket) {
+        sockaddr_un addr = {};
+        addr.sun_family = AF_UNIX;
+        strncpy(addr.sun_path, ep.path.c_str(), sizeof(addr.sun_path) - 1);
+        fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (fd < 0) return -1;
+        if (listening) unlink(ep.path.c_str());
+        int rc = listening ? ::bind(fd, (sockaddr*)&addr, sizeof(addr)) : connect(fd, (sockaddr*)&addr, sizeof(addr));
+        if (rc < 0) { close(fd); return -1; }
+    } else {
+        addrinfo hints = {}, *res = nullptr;
+        hints.ai_family = AF_UNSPEC;
+        hints.ai_socktype = SOCK_STREAM;
+        hints.ai_flags = listening ? AI_PASSIVE : 0;
+        string port = to_string(ep.port);
+        if (getaddrinfo(ep.host.empty() ? nullptr : ep.host.c_str(), port.c_str(), &hints, &res) != 0) return -1;
+        for (addrinfo* ai = res; ai && fd < 0; ai = ai->ai_next) {
+            fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+            if (fd < 0) continue;
+            int one = 1;
+            setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+            setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+            int rc = listening ? ::bind(fd, ai->ai_addr, ai->ai_addrlen) : connect(fd, ai->ai_addr, ai->ai_addrlen);
+            if (rc < 0) { close(fd); fd = -1; }
+        }
+        freeaddrinfo(res);
+        if (fd < 0) return -1;
+    }
+    if (listening && listen(fd, 64) < 0) { close(fd); return -1; }
+    return fd;
+}
+bool sendAll(int fd, const void* data, size_t n) {
+    const char* p = (const char*)data;
+    while (n > 0) {
+        ssize_t k = send(fd, p, n, MSG_NOSIGNAL);
+        if (k < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            pollfd pfd = { fd, POLLOUT, 0 };
+            poll(&pfd, 1, 1000);
+            continue;
+        }
+        if (k < 0 && errno == EINTR) continue;
+        if (k <= 0) return false;
+        p += k; n -= size_t(k);
+    }
+    return true;
+}
+bool recvAll(int fd, void* data, size_t n) {
+    char* p = (char*)data;
+    while (n > 0) {
+        ssize_t k = recv(fd, p, n, 0);
+        if (k < 0 && errno == EINTR) continue;
+        if (k <= 0) return false;
+        p += k; n -= size_t(k);
+    }
+    return true;
+}
+bool sendMsg(int fd, MsgType type, const void* a, size_t na, const void* b = nullptr, size_t nb = 0) {
+    MsgHeader h = { type, uint32_t(na + nb) };
+    return sendAll(fd, &h, sizeof(h)) && sendAll(fd, a, na) && (nb == 0 || sendAll(fd, b, nb));
+}
+
+// -- Worker -- //
+int runWorker(const Endpoint& ep, unsigned threads, int failAfter) {
+    signal(SIGPIPE, SIG_IGN);
+    int fd = -1;
+    for (int attempt = 0; attempt < 50 && fd < 0; ++attempt) {
+        fd = openSocket(ep, false);
+        if (fd < 0) usleep(100 * 1000); // coordinator may still be starting
+    }
+    if (fd < 0) {
+        cerr << "[worker " << getpid() << "] Could not connect\n";
+        return EXIT_FAILURE;
+    }
+    ThreadPool pool(threads);
+    HelloMsg hello = { FARM_MAGIC, FARM_VERSION, pool.size(), uint32_t(getpid()) };
+    sendMsg(fd, MSG_HELLO, &hello, sizeof(hello));
+
+    JobMsg job = {};
+    CpuFramebuffer fb;
+    int tilesDone = 0;
+    for (;;) {
+        MsgHeader h;
+        if (!recvAll(fd, &h, sizeof(h))) break;
+        if (h.type == MSG_JOB && h.size == sizeof(JobMsg)) {
+            if (!recvAll(fd, &job, sizeof(job))) break;
+            if (job.magic != FARM_MAGIC) {
+                cerr << "[worker " << getpid() << "] Job from a different build, quitting\n";
+                break;
+            }
+            job.stars[sizeof(job.stars) - 1] = 0;
+            job.params.stars = loadStars(job.stars);
+        } else if (h.type == MSG_TILE && h.size == sizeof(TileMsg)) {
+            TileMsg t;
+            if (!recvAll(fd, &t, sizeof(t))) break;
+            fb.resize(t.x1 - t.x0, t.y1 - t.y0, t.x0, t.y0);
+            cpu::traceRegion(pool, job.params, job.width, job.height, t.x0, t.y0, t.x1, t.y1, fb);
+            if (!sendMsg(fd, MSG_RESULT, &t, sizeof(t), fb.rgba.data(), fb.rgba.size())) break;
+            if (failAfter > 0 && ++tilesDone == failAfter) _exit(EXIT_FAILURE); // see FarmTestHooks
+        } else if (h.type == MSG_BYE) {
+            break;
+        } else {
+            cerr << "[worker " << getpid() << "] Unexpected message " << h.type << "\n";
+            break;
+        }
+    }
+    close(fd);
+    return 0;
+}
+
+// -- Coordinator -- //
+struct FarmTile {
+    int x0, y0, x1, y1;
+    bool done = false;
+    int copies = 0;            // currently in flight on some worker
+};
+struct WorkerConn {
+    int fd = -1;
+    string name;
+    unsigned threads = 0;
+    bool ready = false;        // got HELLO, has the job
+    vector<char> inbuf;
+    vector<pair<int, Clock::time_point>> inFlight;
+    Clock::time_point connected, lastHeard, firstIssue, lastResult;
+    bool issuedAny = false;
+    int tiles = 0, discarded = 0;
+    int64_t pixels = 0;
+};
+
+struct Coordinator {
+    RenderSettings settings;
+    cpu::TraceParams params;
+    vector<FarmTile> tiles;
+    deque<int> pending;
+    vector<WorkerConn> workers;      // dead workers stay for the report (fd = -1)
+    CpuFramebuffer image;
+    int listenFd = -1;
+    int tilesLeft = 0;
+    int requeued = 0, speculative = 0;
+    double timeoutSeconds = 30.0;
+    double holdSeconds = 0.0;        // no tiles go out before this, see FarmTestHooks
+    double tileSecondsSum = 0.0;     // for the slow-tile threshold
+    int tileSecondsCount = 0;
+    static const int SLOTS = 2;      // tiles in flight per worker, hides the round trip
+
+    void buildTiles() {
+        const int ts = settings.tile;
+        for (int y = 0; y < settings.height; y += ts)
+            for (int x = 0; x < settings.width; x += ts)
+                tiles.push_back({ x, y, min(x + ts, settings.width), min(y + ts, settings.height) });
+        for (int i = 0; i < int(tiles.size()); ++i) pending.push_back(i);
+        tilesLeft = int(tiles.size());
+        image.resize(settings.width, settings.height);
+    }
+
+    void accept() {
+        sockaddr_storage addr;
+        socklen_t len = sizeof(addr);
+        int fd = ::accept(listenFd, (sockaddr*)&addr, &len);
+        if (fd < 0) return;
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+        WorkerConn w;
+        w.fd = fd;
+        char host[INET6_ADDRSTRLEN] = "unix";
+        if (addr.ss_family == AF_INET)
+            inet_ntop(AF_INET, &((sockaddr_in*)&addr)->sin_addr, host, sizeof(host));
+        else if (addr.ss_family == AF_INET6)
+            inet_ntop(AF_INET6, &((sockaddr_in6*)&addr)->sin6_addr, host, sizeof(host));
+        w.name = host;
+        w.connected = w.lastHeard = Clock::now();
+        workers.push_back(std::move(w));
+    }
+
+    void issue(WorkerConn& w, int id) {
+        const FarmTile& t = tiles[id];
+        TileMsg msg = { id, t.x0, t.y0, t.x1, t.y1 };
+        if (!sendMsg(w.fd, MSG_TILE, &msg, sizeof(msg))) {
+            if (tiles[id].copies == 0) pending.push_front(id);   // fill() already took it off the queue
+            drop(w, "send failed");
+            return;
+        }
+        tiles[id].copies++;
+        w.inFlight.push_back({ id, Clock::now() });
+        if (!w.issuedAny) { w.issuedAny = true; w.firstIssue = Clock::now(); }
+    }
+
+    // Longest-running tile that only one worker has, if it's well past the average tile time.
+    int slowTile(const WorkerConn& self) {
+        double avg = tileSecondsCount ? tileSecondsSum / tileSecondsCount : 0.0;
+        double threshold = max(3.0 * avg, 1.0);
+        int best = -1;
+        double bestAge = threshold;
+        auto now = Clock::now();
+        for (const auto& w : workers) {
+            if (&w == &self || w.fd < 0) continue;
+            for (const auto& f : w.inFlight) {
+                double age = chrono::duration<double>(now - f.second).count();
+                if (!tiles[f.first].done && tiles[f.first].copies == 1 && age > bestAge) {
+                    best = f.first;
+                    bestAge = age;
+                }
+            }
+        }
+        return best;
+    }
+
+    void fill(WorkerConn& w) {
+        while (w.fd >= 0 && w.ready && int(w.inFlight.size()) < SLOTS) {
+            while (!pending.empty() && tiles[pending.front()].done) pending.pop_front();
+            int id = -1;
+            if (!pending.empty()) {
+                id = pending.front();
+                pending.pop_front();
+            } else if ((id = slowTile(w)) >= 0) {
+                speculative++;
+            } else {
+                return;
+            }
+            issue(w, id);
+        }
+    }
+
+    void drop(WorkerConn& w, const char* why) {
+        if (w.fd < 0) return;
+        cout << "[coordinator] Lost worker " << w.name << " (" << why << "), re-issuing "
+             << w.inFlight.size() << " tile(s)\n";
+        close(w.fd);
+        w.fd = -1;
+        for (auto& f : w.inFlight) {
+            FarmTile& t = tiles[f.first];
+            if (--t.copies == 0 && !t.done) {
+                pending.push_front(f.first);
+                requeued++;
+            }
+        }
+        w.inFlight.clear();
+    }
+
+    void onResult(WorkerConn& w, const char* payload, size_t size) {
+        TileMsg t;
+        memcpy(&t, payload, sizeof(t));
+        if (t.id < 0 || t.id >= int(tiles.size())) { drop(w, "bad tile id"); return; }
+        FarmTile& tile = tiles[t.id];
+        const int tw = tile.x1 - tile.x0, th = tile.y1 - tile.y0;
+        if (size != sizeof(t) + size_t(tw) * th * 4) { drop(w, "bad tile size"); return; }
+
+        auto it = find_if(w.inFlight.begin(), w.inFlight.end(), [&](const pair<int, Clock::time_point>& f) { return f.first == t.id; });
+        if (it != w.inFlight.end()) {
+            tileSecondsSum += chrono::duration<double>(Clock::now() - it->second).count();
+            tileSecondsCount++;
+            w.inFlight.erase(it);
+        }
+        tile.copies--;
+        if (tile.done) { w.discarded++; return; } // a speculative copy won already
+
+        const char* px = payload + sizeof(t);
+        for (int y = 0; y < th; ++y)
+            memcpy(&image.rgba[(size_t(tile.y0 + y) * image.width + tile.x0) * 4], px + size_t(y) * tw * 4, size_t(tw) * 4);
+        tile.done = true;
+        tilesLeft--;
+        w.tiles++;
+        w.pixels += int64_t(tw) * th;
+        w.lastResult = Clock::now();
+    }
+
+    void onReadable(WorkerConn& w) {
+        char buf[1 << 16];
+        for (;;) {
+            ssize_t k = recv(w.fd, buf, sizeof(buf), 0);
+            if (k > 0) { w.inbuf.insert(w.inbuf.end(), buf, buf + k); continue; }
+            if (k < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) break;
+            if (k < 0 && errno == EINTR) continue;
+            drop(w, k == 0 ? "disconnected" : strerror(errno));
+            return;
+        }
+        w.lastHeard = Clock::now();
+
+        size_t off = 0;
+        while (w.fd >= 0 && w.inbuf.size() - off >= sizeof(MsgHeader)) {
+            MsgHeader h;
+            memcpy(&h, &w.inbuf[off], sizeof(h));
+            if (w.inbuf.size() - off - sizeof(h) < h.size) break;
+            const char* payload = &w.inbuf[off + sizeof(h)];
+            if (h.type == MSG_HELLO && h.size == sizeof(HelloMsg)) {
+                HelloMsg hello;
+                memcpy(&hello, payload, sizeof(hello));
+                if (hello.magic != FARM_MAGIC || hello.version != FARM_VERSION) { drop(w, "protocol mismatch"); break; }
+                w.threads = hello.threads;
+                w.name += " pid " + to_string(hello.pid);
+                JobMsg job = { FARM_MAGIC, settings.width, settings.height, params, {} };
+                job.params.stars = nullptr;
+                strncpy(job.stars, settings.stars.c_str(), sizeof(job.stars) - 1);
+                if (!sendMsg(w.fd, MSG_JOB, &job, sizeof(job))) { drop(w, "send failed"); break; }
+                w.ready = true;
+                cout << "[coordinator] Worker " << w.name << " joined with " << w.threads << " threads\n";
+            } else if (h.type == MSG_RESULT && h.size >= sizeof(TileMsg)) {
+                onResult(w, payload, h.size);
+            } else {
+                drop(w, "unexpected message");
+                break;
+            }
+            off += sizeof(h) + h.size;
+        }
+        if (w.fd >= 0) w.inbuf.erase(w.inbuf.begin(), w.inbuf.begin() + off);
+    }
+
+    // Workers trace their tiles in order and send nothing in between, so the
+    // clock runs on the oldest tile in flight: from its issue, or from the last
+    // message if that came later (a second slot waits for the first). Time spent
+    // idle before the tile doesn't count.
+    void checkTimeouts() {
+        auto now = Clock::now();
+        for (auto& w : workers) {
+            if (w.fd < 0 || w.inFlight.empty()) continue;
+            auto since = max(w.inFlight.front().second, w.lastHeard);
+            if (chrono::duration<double>(now - since).count() > timeoutSeconds) drop(w, "timed out");
+        }
+    }
+
+    void run() {
+        auto t0 = Clock::now();
+        double lastProgress = 0.0;
+        while (tilesLeft > 0) {
+            vector<pollfd> fds;
+            fds.push_back({ listenFd, POLLIN, 0 });
+            vector<size_t> owner;
+            for (size_t i = 0; i < workers.size(); ++i)
+                if (workers[i].fd >= 0) { fds.push_back({ workers[i].fd, POLLIN, 0 }); owner.push_back(i); }
+            poll(fds.data(), fds.size(), 100);
+
+            if (fds[0].revents & POLLIN) accept();
+            for (size_t i = 1; i < fds.size(); ++i)
+                if (fds[i].revents & (POLLIN | POLLHUP | POLLERR)) onReadable(workers[owner[i - 1]]);
+            checkTimeouts();
+            if (chrono::duration<double>(Clock::now() - t0).count() >= holdSeconds)
+                for (auto& w : workers) fill(w);
+
+            double t = chrono::duration<double>(Clock::now() - t0).count();
+            if (t - lastProgress >= 2.0) {
+                lastProgress = t;
+                int alive = 0;
+                for (auto& w : workers) alive += w.fd >= 0;
+                cout << "[coordinator] " << tiles.size() - tilesLeft << "/" << tiles.size()
+                     << " tiles, " << alive << " worker(s)" << endl;
+            }
+        }
+        double total = chrono::duration<double>(Clock::now() - t0).count();
+
+        for (auto& w : workers)
+            if (w.fd >= 0) { sendMsg(w.fd, MSG_BYE, nullptr, 0); close(w.fd); w.fd = -1; }
+        report(total);
+    }
+
+    void report(double total) {
+        cout << "\n[coordinator] " << settings.width << "x" << settings.height << " in " << total << " s ("
+             << double(settings.width) * settings.height / total / 1e6 << " Mrays/s), "
+             << requeued << " tile(s) re-issued from lost workers, " << speculative
+             << " speculative copies of slow tiles\n";
+        cout << left << setw(28) << "worker" << right << setw(8) << "threads" << setw(8) << "tiles"
+             << setw(10) << "Mpix" << setw(10) << "Mrays/s" << setw(11) << "discarded" << "\n";
+        for (const auto& w : workers) {
+            double busy = w.tiles ? chrono::duration<double>(w.lastResult - w.firstIssue).count() : 0.0;
+            cout << left << setw(28) << w.name << right << setw(8) << w.threads << setw(8) << w.tiles
+                 << setw(10) << fixed << setprecision(3) << w.pixels / 1e6
+                 << setw(10) << (busy > 0.0 ? w.pixels / busy / 1e6 : 0.0)
+                 << setw(11) << w.discarded << defaultfloat << setprecision(6) << "\n";
+        }
+    }
+};
+
+// Fault injection for the farm tests, taken from the environment so it stays
+// out of the command line:
+//   BLACKHOLE_FARM_FAIL_AFTER=n  the first spawned worker dies after n tiles
+//   BLACKHOLE_FARM_HOLD=s        the coordinator hands out no tiles for s seconds,
+//                                so the workers sit idle before their first tile
+struct FarmTestHooks {
+    int failAfter = 0;
+    double holdSeconds = 0.0;
+
+    static FarmTestHooks fromEnv() {
+        FarmTestHooks h;
+        if (const char* n = getenv("BLACKHOLE_FARM_FAIL_AFTER")) h.failAfter = max(atoi(n), 0);
+        if (const char* t = getenv("BLACKHOLE_FARM_HOLD")) h.holdSeconds = max(atof(t), 0.0);
+        return h;
+    }
+};
+
+int runCoordinator(const RenderSettings& s, const Endpoint& ep, int spawn, unsigned workerThreads,
+                   double timeout) {
+    signal(SIGPIPE, SIG_IGN);
+    const FarmTestHooks hooks = FarmTestHooks::fromEnv();
+    Coordinator co;
+    co.settings = s;
+    co.params = buildScene(s);
+    co.timeoutSeconds = timeout;
+    co.holdSeconds = hooks.holdSeconds;
+    co.buildTiles();
+    co.listenFd = openSocket(ep, true);
+    if (co.listenFd < 0) {
+        cerr << "Failed to listen: " << strerror(errno) << "\n";
+        exit(EXIT_FAILURE);
+    }
+    cout << "[coordinator] " << co.tiles.size() << " tiles of " << s.tile << "px, listening on "
+         << (ep.unixSocket ? "unix:" + ep.path : ep.host + ":" + to_string(ep.port)) << endl;
+
+    // local workers for a single box / loopback testing
+    Endpoint local = ep;
+    if (!local.unixSocket && (local.host.empty() || local.host == "0.0.0.0")) local.host = "127.0.0.1";
+    vector<pid_t> children;
+    for (int i = 0; i < spawn; ++i) {
+        pid_t pid = fork();
+        if (pid == 0) {
+            close(co.listenFd);
+            _exit(runWorker(local, workerThreads, i == 0 ? hooks.failAfter : 0));
+        }
+        if (pid > 0) children.push_back(pid);
+    }
+
+    co.run();
+    for (pid_t pid : children) waitpid(pid, nullptr, 0);
+    close(co.listenFd);
+    if (ep.unixSocket) unlink(ep.path.c_str());
+
+    if (!writePPM(s.out.c_str(), s.width, s.height, co.image.rgba.data())) {
+        cerr << "Failed to write " << s.out << "\n";
+        return EXIT_FAILURE;
+    }
+    cout << "[coordinator] Wrote " << s.out << "\n";
+    return 0;
+}
+
+// -- Streaming still -- //
+// The image is traced one band of rows at a time, top band first, with the whole
+// pool on each band. Finished bands go through a small queue to a writer thread
+// that streams their scanlines to disk, so memory is `depth` bands no matter how
+// big the image is.
+struct BandQueue {
+    mutex m;
+    condition_variable cv;
+    deque<CpuFramebuffer*> full, free;
+    bool closed = false;
+
+    CpuFramebuffer* pop(deque<CpuFramebuffer*>& q) {
+        unique_lock<mutex> lk(m);
+        cv.wait(lk, [&] { return !q.empty() || (closed && &q == &full); });
+        if (q.empty()) return nullptr;
+        CpuFramebuffer* fb = q.front();
+        q.pop_front();
+        return fb;
+    }
+    void push(deque<CpuFramebuffer*>& q, CpuFramebuffer* fb) {
+        { lock_guard<mutex> lk(m); q.push_back(fb); }
+        cv.notify_all();
+    }
+    void close() {
+        { lock_guard<mutex> lk(m); closed = true; }
+        cv.notify_all();
+    }
+};
+
+// Traces rows [y0, y1) into fb. The first and last rows of an equirect image are
+// the poles, a single direction each, so they are traced once and copied across.
+void traceBand(ThreadPool& pool, const cpu::TraceParams& p, int W, int H, int y0, int y1,
+               CpuFramebuffer& fb) {
+    const bool poles = p.projection == cpu::PROJ_EQUIRECT && H > 1;
+    int t0 = (poles && y0 == 0) ? 1 : y0;
+    int t1 = (poles && y1 == H) ? H - 1 : y1;
+    if (t1 > t0) cpu::traceRegion(pool, p, W, H, 0, t0, W, t1, fb);
+    if (!poles) return;
+    for (int y : { 0, H - 1 }) {
+        if (y < y0 || y >= y1) continue;
+        cpu::traceTile(p, 0, y, 1, y + 1, W, H, fb);
+        uint8_t* row = fb.row(y);
+        for (int x = 1; x < W; ++x) memcpy(row + x * 4, row, 4);
+    }
+}
+
+int runStill(const RenderSettings& s, unsigned threads, int depth) {
+    const int W = s.width, H = s.height;
+    ImageStreamWriter* out = openImageStream(s.out, W, H);
+    if (!out) {
+        cerr << "Failed to open " << s.out << "\n";
+        return EXIT_FAILURE;
+    }
+    cpu::TraceParams params = buildScene(s);
+    ThreadPool pool(threads);
+
+    // tall enough bands that every thread has a few tiles to take
+    const int tilesX = (W + cpu::TILE - 1) / cpu::TILE;
+    const int band = cpu::TILE * max(1, int(pool.size() * 4 + tilesX - 1) / tilesX);
+
+    vector<CpuFramebuffer> buffers(max(depth, 2));
+    BandQueue q;
+    for (auto& b : buffers) q.free.push_back(&b);
+
+    bool writeOk = true;
+    thread writer([&] {
+        while (CpuFramebuffer* fb = q.pop(q.full)) {
+            for (int y = fb->height - 1; y >= 0 && writeOk; --y)
+                writeOk = out->writeRow(&fb->rgba[size_t(y) * fb->width * 4]);
+            q.push(q.free, fb);
+        }
+    });
+
+    auto t0 = Clock::now();
+    double lastProgress = 0.0;
+    for (int yEnd = H; yEnd > 0; yEnd -= band) {
+        int y0 = max(0, yEnd - band);
+        CpuFramebuffer* fb = q.pop(q.free);
+        fb->resize(W, yEnd - y0, 0, y0);
+        traceBand(pool, params, W, H, y0, yEnd, *fb);
+        q.push(q.full, fb);
+
+        double t = chrono::duration<double>(Clock::now() - t0).count();
+        if (t - lastProgress >= 2.0) {
+            lastProgress = t;
+            cout << "[still] " << fixed << setprecision(1) << 100.0 * (H - y0) / H << "% ("
+                 << (H - y0) << "/" << H << " rows)" << defaultfloat << setprecision(6) << endl;
+        }
+    }
+    q.close();
+    writer.join();
+    bool ok = out->finish() && writeOk;
+    delete out;
+
+    double total = chrono::duration<double>(Clock::now() - t0).count();
+    cout << "[still] " << W << "x" << H << " in " << total << " s ("
+         << double(W) * H / total / 1e6 << " Mrays/s), " << buffers.size() << " bands of "
+         << band << " rows in flight = " << double(buffers.size()) * W * band * 4 / (1 << 20)
+         << " MB of pixels\n";
+    if (!ok) {
+        cerr << "Failed to write " << s.out << "\n";
+        return EXIT_FAILURE;
+    }
+    cout << "[still] Wrote " << s.out << "\n";
+    return 0;
+}
+
+// -- Cube map -- //
+// Six N x N faces around the camera. Tiles of all faces go through one
+// parallelFor, face-major, so faces finish roughly in order; a writer thread
+// streams each face to <out>_<face>.<ext> once it and the faces before it are
+// done, then frees it. Neighbouring faces sample their shared borders with
+// identical rays (cpu::cubeLattice). Each of those is traced only by the
+// lowest-numbered face that has it, and the later faces copy it from the
+// borders kept from the faces already written.
+const char* CUBE_FACE_NAMES[6] = { "front", "right", "back", "left", "up", "down" };
+
+string faceFileName(const string& out, int face) {
+    size_t dot = out.rfind('.');
+    if (dot == string::npos || out.find('/', dot) != string::npos) dot = out.size();
+    return out.substr(0, dot) + "_" + CUBE_FACE_NAMES[face] + out.substr(dot);
+}
+
+struct CubeFace {
+    int x0 = 0, y0 = 0, x1 = 0, y1 = 0;  // the rays this face traces itself
+    CpuFramebuffer fb;
+    once_flag allocated;
+    atomic<int> tilesLeft{0};
+    vector<uint8_t> edges[4];            // rows 0 and N-1, columns 0 and N-1, kept after writing
+
+    const uint8_t* edgePixel(int i, int j, int N) const {
+        if (j == 0)     return &edges[0][size_t(i) * 4];
+        if (j == N - 1) return &edges[1][size_t(i) * 4];
+        if (i == 0)     return &edges[2][size_t(j) * 4];
+        return &edges[3][size_t(j) * 4];
+    }
+    void keepEdges(int N) {
+        for (auto& e : edges) e.resize(size_t(N) * 4);
+        for (int k = 0; k < N; ++k) {
+            memcpy(&edges[0][k * 4], &fb.rgba[(size_t(0) * N + k) * 4], 4);
+            memcpy(&edges[1][k * 4], &fb.rgba[(size_t(N - 1) * N + k) * 4], 4);
+            memcpy(&edges[2][k * 4], &fb.rgba[(size_t(k) * N + 0) * 4], 4);
+            memcpy(&edges[3][k * 4], &fb.rgba[(size_t(k) * N + N - 1) * 4], 4);
+        }
+    }
+};
+
+int runCubemap(const RenderSettings& s, unsigned threads) {
+    const int N = s.face;
+    if (N < 3) {
+        cerr << "Cube map faces must be at least 3px\n";
+        return EXIT_FAILURE;
+    }
+    RenderSettings sq = s;
+    sq.width = sq.height = N;
+    cpu::TraceParams params = buildScene(sq);
+    params.projection = cpu::PROJ_CUBE_FACE;
+    ThreadPool pool(threads);
+
+    // Ownership of a shared border is all-or-nothing per edge, so what each
+    // face traces is a rectangle: the full face minus the edges it borrows.
+    CubeFace faces[6];
+    struct Tile { int face, x0, y0, x1, y1; };
+    vector<Tile> tiles;
+    long long traced = 0;
+    for (int f = 0; f < 6; ++f) {
+        auto owns = [&](int i, int j) { return cpu::cubeOwner(cpu::cubeLattice(f, i, j, N), N) == f; };
+        CubeFace& cf = faces[f];
+        cf.x0 = owns(0, N / 2) ? 0 : 1;
+        cf.x1 = owns(N - 1, N / 2) ? N : N - 1;
+        cf.y0 = owns(N / 2, 0) ? 0 : 1;
+        cf.y1 = owns(N / 2, N - 1) ? N : N - 1;
+        traced += (long long)(cf.x1 - cf.x0) * (cf.y1 - cf.y0);
+        for (int y = cf.y0; y < cf.y1; y += s.tile)
+            for (int x = cf.x0; x < cf.x1; x += s.tile)
+                tiles.push_back({ f, x, y, min(x + s.tile, cf.x1), min(y + s.tile, cf.y1) });
+    }
+    for (const Tile& t : tiles) faces[t.face].tilesLeft++;
+
+    mutex m;
+    condition_variable cv;
+    bool ok = true;
+    auto t0 = Clock::now();
+    thread writer([&] {
+        for (int f = 0; f < 6; ++f) {
+            CubeFace& cf = faces[f];
+            {
+                unique_lock<mutex> lk(m);
+                cv.wait(lk, [&] { return cf.tilesLeft.load() == 0; });
+            }
+            // borrowed border rays come from faces that are already written
+            for (int j = 0; j < N; ++j)
+                for (int i = 0; i < N; ++i) {
+                    if (i >= cf.x0 && i < cf.x1 && j >= cf.y0 && j < cf.y1) continue;
+                    glm::ivec3 L = cpu::cubeLattice(f, i, j, N);
+                    int g = cpu::cubeOwner(L, N);
+                    glm::ivec2 q = cpu::cubePixel(g, L, N);
+                    memcpy(&cf.fb.rgba[(size_t(j) * N + i) * 4], faces[g].edgePixel(q.x, q.y, N), 4);
+                }
+            cf.keepEdges(N);
+
+            string path = faceFileName(s.out, f);
+            ImageStreamWriter* out = openImageStream(path, N, N);
+            bool faceOk = out != nullptr;
+            for (int y = N - 1; y >= 0 && faceOk; --y)
+                faceOk = out->writeRow(&cf.fb.rgba[size_t(y) * N * 4]);
+            faceOk = out && out->finish() && faceOk;
+            delete out;
+            vector<uint8_t>().swap(cf.fb.rgba);
+
+            double t = chrono::duration<double>(Clock::now() - t0).count();
+            if (faceOk) cout << "[cubemap] " << CUBE_FACE_NAMES[f] << " done at " << t << " s -> " << path << endl;
+            else cerr << "Failed to write " << path << "\n";
+            ok = ok && faceOk;
+        }
+    });
+
+    pool.parallelFor(int(tiles.size()), [&](int k) {
+        const Tile& t = tiles[k];
+        CubeFace& cf = faces[t.face];
+        call_once(cf.allocated, [&] { cf.fb.resize(N, N); });
+        cpu::TraceParams p = params;
+        p.face = t.face;
+        cpu::traceTile(p, t.x0, t.y0, t.x1, t.y1, N, N, cf.fb);
+        if (--cf.tilesLeft == 0) {
+            { lock_guard<mutex> lk(m); }
+            cv.notify_all();
+        }
+    });
+    writer.join();
+
+    double total = chrono::duration<double>(Clock::now() - t0).count();
+    long long pixels = 6LL * N * N;
+    cout << "[cubemap] 6 x " << N << "x" << N << " in " << total << " s ("
+         << traced / total / 1e6 << " Mrays/s), " << traced << " rays for " << pixels
+         << " pixels (" << pixels - traced << " shared border rays traced once)\n";
+    return ok ? 0 : EXIT_FAILURE;
+}
+
+// -- Benchmark -- //
+// One view through the Schwarzschild path, the Kerr path at a spin too small to
+// matter (same picture, so it checks the Kerr integrator against the old one)
+// and the Kerr path at --spin, with the thin disk and then the volumetric one.
+int runBench(const RenderSettings& s, unsigned threads) {
+    const int W = s.width, H = s.height;
+    ThreadPool pool(threads);
+    struct Run { const char* name; float spin, thickness; };
+    const Run runs[] = { { "schwarzschild", 0.0f, 0.0f }, { "kerr a~0", 1e-6f, 0.0f },
+                         { "kerr", s.spin, 0.0f }, { "kerr thick", s.spin, s.diskThickness } };
+    const int numRuns = 4;
+    vector<CpuFramebuffer> images(numRuns);
+
+    cout << "[bench] " << W << "x" << H << ", " << pool.size() << " threads\n"
+         << left << setw(16) << "path" << setw(8) << "spin" << right << setw(10) << "ms"
+         << setw(12) << "Mrays/s" << setw(12) << "steps/ray" << setw(12) << "Msteps/s" << "\n";
+    for (int i = 0; i < numRuns; ++i) {
+        RenderSettings scene = s;
+        scene.diskThickness = runs[i].thickness;
+        cpu::TraceParams params = buildScene(scene);
+        params.spin = runs[i].spin;
+        images[i].resize(W, H);
+        atomic<int64_t> steps{0};
+        auto t0 = Clock::now();
+        cpu::traceRegion(pool, params, W, H, 0, 0, W, H, images[i], nullptr, &steps);
+        double sec = chrono::duration<double>(Clock::now() - t0).count();
+        double rays = double(W) * H;
+        cout << left << setw(16) << runs[i].name << setw(8) << runs[i].spin << right << fixed
+             << setprecision(1) << setw(10) << sec * 1000.0 << setprecision(3) << setw(12)
+             << rays / sec / 1e6 << setprecision(1) << setw(12) << steps / rays << setw(12)
+             << steps / sec / 1e6 << defaultfloat << setprecision(6) << "\n";
+    }
+
+    // pixels where the two a = 0 pictures differ by more than a couple of levels
+    size_t differ = 0;
+    for (size_t k = 0; k < images[0].rgba.size(); k += 4)
+        for (int ch = 0; ch < 3; ++ch)
+            if (abs(int(images[0].rgba[k + ch]) - int(images[1].rgba[k + ch])) > 2) { ++differ; break; }
+    cout << "[bench] kerr a~0 vs schwarzschild: " << fixed << setprecision(2)
+         << 100.0 * differ / (double(W) * H) << "% of pixels differ" << defaultfloat << setprecision(6) << "\n";
+    if (!s.out.empty() && s.out != "render.ppm") writePPM(s.out.c_str(), W, H, images[3].rgba.data());
+    return 0;
+}
+
+// -- MAIN -- //
+void usage() {
+    cerr << "usage:\n"
+            "  BlackHoleRender coordinator [--listen tcp:0.0.0.0:7070 | unix:/tmp/bh.sock] [--spawn N]\n"
+            "                  [--size WxH] [--tile px] [--out file.ppm] [--timeout s]\n"
+            "                  [--radius m] [--azimuth deg] [--elevation deg] [--fov deg]\n"
+            "  BlackHoleRender worker --connect tcp:host:7070 | unix:/tmp/bh.sock [--threads N]\n"
+            "  BlackHoleRender still [--size WxH] [--out file.png|file.ppm] [--threads N] [--queue bands]\n"
+            "                  [--radius m] [--azimuth deg] [--elevation deg] [--fov deg]\n"
+            "  BlackHoleRender cubemap [--face N] [--out sky.png] [--threads N] [--tile px]\n"
+            "                  [--radius m] [--azimuth deg] [--elevation deg]\n"
+            "  BlackHoleRender bench [--size WxH] [--spin a] [--disk-thickness h] [--threads N] [--out thick.ppm]\n"
+            "  every mode takes --spin a (J/M, -1 < a < 1) for a Kerr hole spinning about +y\n"
+            "  and --disk-thickness h (scale height in r_s) for a volumetric accretion disk,\n"
+            "  --stars sky.stars [--star-exposure e] for a BuildStarCatalog star field behind it;\n"
+            "  coordinator and still take --projection pinhole|equirect (use a 2:1 --size for 360)\n";
+}
+
+int main(int argc, char** argv) {
+    if (argc < 2) { usage(); return EXIT_FAILURE; }
+    string mode = argv[1];
+    RenderSettings s;
+    string endpoint = "tcp:0.0.0.0:7070";
+    int spawn = 0, queueDepth = 3;
+    unsigned threads = 0;
+    double timeout = 30.0;
+    bool sizeGiven = false;
+    for (int i = 2; i < argc; ++i) {
+        string a = argv[i];
+        auto next = [&]() -> const char* {
+            if (i + 1 >= argc) { usage(); exit(EXIT_FAILURE); }
+            return argv[++i];
+        };
+        if (a == "--listen" || a == "--connect") endpoint = next();
+        else if (a == "--spawn") spawn = atoi(next());
+        else if (a == "--threads") threads = unsigned(atoi(next()));
+        else if (a == "--size") {
+            if (sscanf(next(), "%dx%d", &s.width, &s.height) != 2) { usage(); return EXIT_FAILURE; }
+            sizeGiven = true;
+        }
+        else if (a == "--tile") s.tile = max(atoi(next()), cpu::TILE);
+        else if (a == "--out") s.out = next();
+        else if (a == "--timeout") timeout = atof(next());
+        else if (a == "--radius") s.radius = float(atof(next()));
+        else if (a == "--azimuth") s.azimuth = float(atof(next()));
+        else if (a == "--elevation") s.elevation = float(atof(next()));
+        else if (a == "--fov") s.fov = float(atof(next()));
+        else if (a == "--face") s.face = atoi(next());
+        else if (a == "--spin") s.spin = glm::clamp(float(atof(next())), -0.999f, 0.999f);
+        else if (a == "--disk-thickness") s.diskThickness = max(float(atof(next())), 0.0f);
+        else if (a == "--stars") s.stars = next();
+        else if (a == "--star-exposure") s.starExposure = float(atof(next()));
+        else if (a == "--projection") {
+            string proj = next();
+            if (proj == "pinhole") s.projection = cpu::PROJ_PINHOLE;
+            else if (proj == "equirect") s.projection = cpu::PROJ_EQUIRECT;
+            else { usage(); return EXIT_FAILURE; }
+        }
+        else if (a == "--queue") queueDepth = atoi(next());
+        else { usage(); return EXIT_FAILURE; }
+    }
+    if (threads == 0) threads = thread::hardware_concurrency();
+    if (s.stars.size() >= sizeof(JobMsg::stars)) {
+        cerr << "Star catalog path too long: " << s.stars << "\n";
+        return EXIT_FAILURE;
+    }
+
+    if (mode == "coordinator") return runCoordinator(s, parseEndpoint(endpoint), spawn, threads, timeout);
+    if (mode == "worker") return runWorker(parseEndpoint(endpoint), threads, 0);
+    if (mode == "still") return runStill(s, threads, queueDepth);
+    if (mode == "cubemap") return runCubemap(s, threads);
+    if (mode == "bench") {
+        if (!sizeGiven) { s.width = 160; s.height = 90; }
+        if (s.spin == 0.0f) s.spin = 0.9f;
+        if (s.diskThickness == 0.0f) s.diskThickness = 0.1f;
+        return runBench(s, threads);
+    }
+    usage();
+    return EXIT_FAILURE;
+}
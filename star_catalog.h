@@ -0,0 +1,304 @@
+#pragma once
+// Star catalog background for escaped rays.
+// BuildStarCatalog bins a catalog into a HEALPix-indexed file. Per-cell flux
+// sums are stored for every order 0..order like a mip chain, followed by the
+// stars themselves sorted by finest cell. The tracer memory-maps that file and
+// looks a direction up in O(1): one cell per mip level, or the handful of
+// stars in one finest cell. Nothing is read up front, so startup costs the
+// same for 10^3 stars as for 10^8, and only the pages the rays touch load.
+//
+// The sky frame is the scene's: HEALPix z is +y (the disk normal and the spin
+// axis) and phi runs from +x towards +z.
+#include <glm/glm.hpp>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <algorithm>
+#ifdef _WIN32
+#  ifndef NOMINMAX
+#    define NOMINMAX
+#  endif
+#  ifndef WIN32_LEAN_AND_MEAN
+#    define WIN32_LEAN_AND_MEAN
+#  endif
+#  include <windows.h>
+#else
+#  include <sys/mman.h>
+#  include <sys/stat.h>
+#  include <fcntl.h>
+#  include <unistd.h>
+#endif
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+// -- HEALPix (nested scheme) -- //
+// Cell i of order k has children 4i .. 4i+3 at order k + 1, which is what makes
+// the per-order flux sums a mip chain.
+const int HEALPIX_MAX_ORDER = 13;        // 12 * 4^13 cells still fit an int32
+
+inline int64_t healpixCells(int order) { return int64_t(12) << (2 * order); }
+// Cells of orders 0..order-1, i.e. where order `order` starts in a flat mip chain.
+inline int64_t healpixLevelStart(int order) { return 4 * ((int64_t(1) << (2 * order)) - 1); }
+inline double healpixCellArea(int order) { return 4.0 * M_PI / double(healpixCells(order)); }
+
+inline int64_t spreadBits(int64_t v) {
+    v &= 0xFFFFFFFF;
+    v = (v | (v << 16)) & 0x0000FFFF0000FFFFll;
+    v = (v | (v << 8))  & 0x00FF00FF00FF00FFll;
+    v = (v | (v << 4))  & 0x0F0F0F0F0F0F0F0Fll;
+    v = (v | (v << 2))  & 0x3333333333333333ll;
+    v = (v | (v << 1))  & 0x5555555555555555ll;
+    return v;
+}
+
+// Nested cell of order `order` containing the direction with z = cos(theta)
+// and azimuth phi (any range).
+inline int64_t healpixNest(int order, double z, double phi) {
+    const int64_t nside = int64_t(1) << order;
+    double za = std::fabs(z);
+    double tt = std::fmod(phi * (2.0 / M_PI), 4.0);
+    if (tt < 0.0) tt += 4.0;
+    int64_t face, ix, iy;
+    if (za <= 2.0 / 3.0) {
+        // equatorial belt
+        double t1 = double(nside) * (0.5 + tt), t2 = double(nside) * (z * 0.75);
+        int64_t jp = int64_t(t1 - t2), jm = int64_t(t1 + t2);
+        int64_t ifp = jp >> order, ifm = jm >> order;
+        face = ifp == ifm ? (ifp | 4) : (ifp < ifm ? ifp : ifm + 8);
+        ix = jm & (nside - 1);
+        iy = nside - (jp & (nside - 1)) - 1;
+    } else {
+        // polar caps
+        int64_t ntt = std::min<int64_t>(3, int64_t(tt));
+        double tp = tt - double(ntt);
+        double tmp = double(nside) * std::sqrt(3.0 * (1.0 - za));
+        int64_t jp = std::min<int64_t>(int64_t(tp * tmp), nside - 1);
+        int64_t jm = std::min<int64_t>(int64_t((1.0 - tp) * tmp), nside - 1);
+        if (z >= 0.0) { face = ntt;     ix = nside - jm - 1; iy = nside - jp - 1; }
+        else          { face = ntt + 8; ix = jp;             iy = jm; }
+    }
+    return (face << (2 * order)) + spreadBits(ix) + (spreadBits(iy) << 1);
+}
+inline int64_t healpixNest(int order, glm::vec3 dir) {
+    return healpixNest(order, glm::clamp(dir.y / glm::length(dir), -1.0f, 1.0f), std::atan2(dir.z, dir.x));
+}
+
+// -- File format -- //
+// [StarFileHeader][float rgb flux per cell, orders 0..order][uint32 first star
+// per finest cell, cells + 1 entries][StarRecord per star, sorted by finest
+// cell]. Flux is linear, 1.0 = a magnitude 0 star. Native endianness.
+const char     STAR_FILE_MAGIC[8]  = { 'B', 'H', 'S', 'T', 'A', 'R', 'S', 0 };
+const uint32_t STAR_FILE_VERSION   = 1;
+
+struct StarFileHeader {
+    char     magic[8];
+    uint32_t version;
+    uint32_t order;                // finest HEALPix order
+    uint64_t numStars;
+    uint64_t cellsOffset;          // bytes from the start of the file
+    uint64_t indexOffset;
+    uint64_t starsOffset;
+    uint64_t fileSize;
+};
+struct StarRecord {
+    float x, y, z;                 // unit direction
+    float r, g, b;                 // flux
+};
+static_assert(sizeof(StarFileHeader) == 56, "StarFileHeader is written as-is");
+static_assert(sizeof(StarRecord) == 24, "StarRecord is written as-is");
+
+inline void starFileLayout(StarFileHeader& h, int order, uint64_t numStars) {
+    std::memcpy(h.magic, STAR_FILE_MAGIC, 8);
+    h.version = STAR_FILE_VERSION;
+    h.order = uint32_t(order);
+    h.numStars = numStars;
+    h.cellsOffset = 64;
+    h.indexOffset = h.cellsOffset + uint64_t(healpixLevelStart(order + 1)) * 3 * sizeof(float);
+    h.starsOffset = h.indexOffset + (uint64_t(healpixCells(order)) + 1) * sizeof(uint32_t);
+    h.starsOffset = (h.starsOffset + 63) & ~uint64_t(63);
+    h.fileSize = h.starsOffset + numStars * sizeof(StarRecord);
+}
+
+// Colour of a star of B-V colour index bv, scaled so r + g + b = 3.
+inline glm::vec3 starColour(float bv) {
+    static const float bvs[] = { -0.4f, 0.0f, 0.4f, 0.8f, 1.2f, 1.6f, 2.0f };
+    static const glm::vec3 rgb[] = {
+        { 0.61f, 0.69f, 1.00f }, { 0.79f, 0.84f, 1.00f }, { 1.00f, 0.96f, 0.92f },
+        { 1.00f, 0.86f, 0.71f }, { 1.00f, 0.76f, 0.51f }, { 1.00f, 0.65f, 0.35f },
+        { 1.00f, 0.55f, 0.24f },
+    };
+    bv = glm::clamp(bv, bvs[0], bvs[6] - 1e-4f);
+    int i = 0;
+    while (bv > bvs[i + 1]) ++i;
+    glm::vec3 c = glm::mix(rgb[i], rgb[i + 1], (bv - bvs[i]) / (bvs[i + 1] - bvs[i]));
+    return c * (3.0f / (c.r + c.g + c.b));
+}
+
+// -- Mapped file -- //
+struct MappedFile {
+    uint8_t* data = nullptr;
+    uint64_t size = 0;
+
+    MappedFile() {}
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+    ~MappedFile() { close(); }
+
+    // Read-only view of an existing file, or (size > 0) a new file of that size
+    // mapped for writing.
+    bool open(const char* path, uint64_t createSize = 0) {
+        close();
+        const bool create = createSize > 0;
+#ifdef _WIN32
+        file = CreateFileA(path, create ? GENERIC_READ | GENERIC_WRITE : GENERIC_READ, FILE_SHARE_READ,
+                           nullptr, create ? CREATE_ALWAYS : OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+        if (file == INVALID_HANDLE_VALUE) return false;
+        LARGE_INTEGER len;
+        if (create) len.QuadPart = LONGLONG(createSize);
+        else if (!GetFileSizeEx(file, &len)) { close(); return false; }
+        size = uint64_t(len.QuadPart);
+        if (size == 0) { close(); return false; }
+        mapping = CreateFileMappingA(file, nullptr, create ? PAGE_READWRITE : PAGE_READONLY,
+                                     DWORD(size >> 32), DWORD(size), nullptr);
+        if (!mapping) { close(); return false; }
+        data = static_cast<uint8_t*>(MapViewOfFile(mapping, create ? FILE_MAP_WRITE : FILE_MAP_READ, 0, 0, 0));
+#else
+        fd = ::open(path, create ? O_RDWR | O_CREAT | O_TRUNC : O_RDONLY, 0644);
+        if (fd < 0) return false;
+        if (create) {
+            if (ftruncate(fd, off_t(createSize)) != 0) { close(); return false; }
+            size = createSize;
+        } else {
+            struct stat st;
+            if (fstat(fd, &st) != 0 || st.st_size <= 0) { close(); return false; }
+            size = uint64_t(st.st_size);
+        }
+        void* p = mmap(nullptr, size_t(size), create ? PROT_READ | PROT_WRITE : PROT_READ, MAP_SHARED, fd, 0);
+        data = p == MAP_FAILED ? nullptr : static_cast<uint8_t*>(p);
+#endif
+        if (!data) { close(); return false; }
+        return true;
+    }
+    void close() {
+#ifdef _WIN32
+        if (data) UnmapViewOfFile(data);
+        if (mapping) CloseHandle(mapping);
+        if (file != INVALID_HANDLE_VALUE) CloseHandle(file);
+        mapping = nullptr;
+        file = INVALID_HANDLE_VALUE;
+#else
+        if (data) munmap(data, size_t(size));
+        if (fd >= 0) ::close(fd);
+        fd = -1;
+#endif
+        data = nullptr;
+        size = 0;
+    }
+
+private:
+#ifdef _WIN32
+    HANDLE file = INVALID_HANDLE_VALUE, mapping = nullptr;
+#else
+    int fd = -1;
+#endif
+};
+
+// -- Catalog -- //
+struct StarCatalog {
+    MappedFile file;
+    int order = 0;
+    uint64_t numStars = 0;
+    const float* cells = nullptr;        // rgb per cell, flat mip chain
+    const uint32_t* index = nullptr;     // finest cell -> first star
+    const StarRecord* stars = nullptr;
+
+    // Maps path and checks the header; on failure *error says why.
+    bool open(const char* path, std::string* error = nullptr) {
+        auto fail = [&](const char* why) {
+            if (error) *error = std::string(path) + ": " + why;
+            file.close();
+            return false;
+        };
+        if (!file.open(path)) return fail("cannot open or map the file");
+        if (file.size < sizeof(StarFileHeader)) return fail("too small for a star catalog");
+        StarFileHeader h;
+        std::memcpy(&h, file.data, sizeof(h));
+        if (std::memcmp(h.magic, STAR_FILE_MAGIC, 8) != 0) return fail("not a star catalog (run BuildStarCatalog)");
+        if (h.version != STAR_FILE_VERSION) return fail("star catalog from a different version, rebuild it");
+        if (h.order > uint32_t(HEALPIX_MAX_ORDER)) return fail("bad HEALPix order");
+        StarFileHeader expect;
+        starFileLayout(expect, int(h.order), h.numStars);
+        if (h.cellsOffset != expect.cellsOffset || h.indexOffset != expect.indexOffset ||
+            h.starsOffset != expect.starsOffset || h.fileSize != expect.fileSize || file.size < h.fileSize)
+            return fail("truncated or corrupt star catalog");
+        order = int(h.order);
+        numStars = h.numStars;
+        cells = reinterpret_cast<const float*>(file.data + h.cellsOffset);
+        index = reinterpret_cast<const uint32_t*>(file.data + h.indexOffset);
+        stars = reinterpret_cast<const StarRecord*>(file.data + h.starsOffset);
+        return true;
+    }
+    bool isOpen() const { return file.data != nullptr; }
+
+    // Flux of order-k cell i spread over `footprint` steradians.
+    glm::vec3 cellFlux(int k, int64_t i, float footprint) const {
+        const float* c = cells + (healpixLevelStart(k) + i) * 3;
+        return glm::vec3(c[0], c[1], c[2]) * float(footprint / healpixCellArea(k));
+    }
+
+    // Flux collected by a pixel of solid angle `footprint` looking along dir
+    // (unit). Pixels coarser than the finest cells read the mip level whose
+    // cells match the footprint, blending two levels. Much finer pixels see the
+    // individual stars through a Gaussian the size of a pixel, normalised so a
+    // star's flux adds up to about its own over the image; the cells under the
+    // corners of a 3 sigma box around dir are searched, which covers the box
+    // once cells are larger than it. In between, the finest level is blended
+    // into the stars. maxOrder >= 0 reads only mip levels 0..maxOrder and never
+    // single stars, which is what geodesic.comp sees of its copy of the top
+    // levels, even when the catalog has no finer ones.
+    glm::vec3 flux(glm::vec3 dir, float footprint, int maxOrder = -1) const {
+        double level = 0.5 * std::log2(healpixCellArea(0) / std::max(double(footprint), 1e-30));
+        level = std::max(level, 0.0);
+        if (maxOrder >= 0) level = std::min(level, double(std::min(maxOrder, order)));
+        if (level < double(order) || maxOrder >= 0) {
+            int k = int(level);
+            float w = float(level - k);
+            glm::vec3 f = cellFlux(k, healpixNest(k, dir), footprint);
+            if (w > 0.0f) f = glm::mix(f, cellFlux(k + 1, healpixNest(k + 1, dir), footprint), w);
+            return f;
+        }
+        // the 3 sigma box is 2.4 pixels wide, so cells 1.5 orders finer than a pixel hold it
+        float w = float(glm::clamp(level - double(order) - 0.5, 0.0, 1.0));
+        int64_t cell = healpixNest(order, dir);
+        glm::vec3 density = cellFlux(order, cell, footprint);
+        if (w == 0.0f) return density;
+
+        const float sigma2 = footprint / (2.0f * float(M_PI));
+        const float reach = 3.0f * std::sqrt(sigma2);
+        glm::vec3 e1 = glm::cross(dir, std::fabs(dir.y) < 0.9f ? glm::vec3(0, 1, 0) : glm::vec3(1, 0, 0));
+        e1 = glm::normalize(e1) * reach;
+        glm::vec3 e2 = glm::normalize(glm::cross(dir, e1)) * reach;
+        int64_t search[5] = { cell, healpixNest(order, dir + e1 + e2), healpixNest(order, dir + e1 - e2),
+                              healpixNest(order, dir - e1 + e2), healpixNest(order, dir - e1 - e2) };
+        glm::vec3 f(0.0f);
+        for (int c = 0; c < 5; ++c) {
+            if (std::find(search, search + c, search[c]) != search + c) continue;
+            for (uint32_t i = index[search[c]], end = index[search[c] + 1]; i < end; ++i) {
+                const StarRecord& s = stars[i];
+                float dx = dir.x - s.x, dy = dir.y - s.y, dz = dir.z - s.z;
+                float d2 = dx*dx + dy*dy + dz*dz;
+                if (d2 < 9.0f * sigma2) f += std::exp(-0.5f * d2 / sigma2) * glm::vec3(s.r, s.g, s.b);
+            }
+        }
+        return glm::mix(density, f, w);
+    }
+};
+
+// Flux to display colour: about linear for faint stars, rolling off towards 1
+// for bright ones instead of clipping.
+inline glm::vec3 starDisplay(glm::vec3 flux, float exposure) {
+    glm::vec3 v = flux * exposure;
+    return glm::vec3(1.0f) - glm::vec3(std::exp(-v.x), std::exp(-v.y), std::exp(-v.z));
+}